@@ -0,0 +1,193 @@
+#include "mantle_internal.h"
+
+#define MAX_UNUSED_RELEASE_COUNT    (4096) // Releases before an unused view gets destroyed
+
+static BufferViewCacheBucket* getBufferViewCacheBucket(
+    const GrDevice* grDevice,
+    VkBuffer vkBuffer,
+    VkDeviceSize offset,
+    VkDeviceSize range)
+{
+    uint64_t hash = HASH_INIT;
+
+    // Format is left out so that views can be released from the slot contents alone
+    hash = getHash(hash, &vkBuffer, sizeof(vkBuffer));
+    hash = getHash(hash, &offset, sizeof(offset));
+    hash = getHash(hash, &range, sizeof(range));
+
+    return &grDevice->bufferViewCache[hash % BUFFER_VIEW_CACHE_BUCKET_COUNT];
+}
+
+static void removeBufferViewCacheEntry(
+    const GrDevice* grDevice,
+    BufferViewCacheBucket* bucket,
+    unsigned index)
+{
+    VKD.vkDestroyBufferView(grDevice->device, bucket->entries[index].bufferView, NULL);
+
+    bucket->entryCount--;
+    bucket->entries[index] = bucket->entries[bucket->entryCount];
+}
+
+static void trimBufferViewCacheBucket(
+    const GrDevice* grDevice,
+    BufferViewCacheBucket* bucket)
+{
+    for (unsigned i = 0; i < bucket->entryCount;) {
+        const BufferViewCacheEntry* entry = &bucket->entries[i];
+
+        // Unused views stay around for a while, recorded descriptor sets may still use them
+        if (entry->refCount == 0 &&
+            grDevice->bufferViewReleaseCount - entry->releaseIndex > MAX_UNUSED_RELEASE_COUNT) {
+            removeBufferViewCacheEntry(grDevice, bucket, i);
+        } else {
+            i++;
+        }
+    }
+}
+
+VkBufferView grDeviceAcquireBufferView(
+    GrDevice* grDevice,
+    VkBuffer vkBuffer,
+    VkDeviceSize offset,
+    VkDeviceSize range,
+    VkFormat vkFormat)
+{
+    VkBufferView vkBufferView = VK_NULL_HANDLE;
+
+    AcquireSRWLockExclusive(&grDevice->bufferViewLock);
+
+    BufferViewCacheBucket* bucket = getBufferViewCacheBucket(grDevice, vkBuffer, offset, range);
+
+    for (unsigned i = 0; i < bucket->entryCount; i++) {
+        BufferViewCacheEntry* entry = &bucket->entries[i];
+
+        if (entry->buffer == vkBuffer && entry->offset == offset && entry->range == range &&
+            entry->format == vkFormat) {
+            entry->refCount++;
+            ReleaseSRWLockExclusive(&grDevice->bufferViewLock);
+            return entry->bufferView;
+        }
+    }
+
+    const VkBufferViewCreateInfo createInfo = {
+        .sType = VK_STRUCTURE_TYPE_BUFFER_VIEW_CREATE_INFO,
+        .pNext = NULL,
+        .flags = 0,
+        .buffer = vkBuffer,
+        .format = vkFormat,
+        .offset = offset,
+        .range = range,
+    };
+
+    VkResult vkRes = VKD.vkCreateBufferView(grDevice->device, &createInfo, NULL, &vkBufferView);
+    if (vkRes != VK_SUCCESS) {
+        LOGE("vkCreateBufferView failed (%d)\n", vkRes);
+        ReleaseSRWLockExclusive(&grDevice->bufferViewLock);
+        return VK_NULL_HANDLE;
+    }
+
+    bucket->entryCount++;
+    bucket->entries = realloc(bucket->entries, bucket->entryCount * sizeof(BufferViewCacheEntry));
+    bucket->entries[bucket->entryCount - 1] = (BufferViewCacheEntry) {
+        .buffer = vkBuffer,
+        .offset = offset,
+        .range = range,
+        .format = vkFormat,
+        .bufferView = vkBufferView,
+        .refCount = 1,
+        .releaseIndex = 0,
+    };
+
+    ReleaseSRWLockExclusive(&grDevice->bufferViewLock);
+
+    return vkBufferView;
+}
+
+void grDeviceReleaseBufferView(
+    GrDevice* grDevice,
+    VkBuffer vkBuffer,
+    VkDeviceSize offset,
+    VkDeviceSize range,
+    VkBufferView vkBufferView)
+{
+    AcquireSRWLockExclusive(&grDevice->bufferViewLock);
+
+    BufferViewCacheBucket* bucket = getBufferViewCacheBucket(grDevice, vkBuffer, offset, range);
+
+    grDevice->bufferViewReleaseCount++;
+
+    for (unsigned i = 0; i < bucket->entryCount; i++) {
+        BufferViewCacheEntry* entry = &bucket->entries[i];
+
+        if (entry->bufferView != vkBufferView) {
+            continue;
+        }
+
+        assert(entry->refCount > 0);
+        entry->refCount--;
+        entry->releaseIndex = grDevice->bufferViewReleaseCount;
+
+        if (entry->refCount == 0 && entry->buffer == VK_NULL_HANDLE) {
+            // Nothing can hit this view anymore
+            removeBufferViewCacheEntry(grDevice, bucket, i);
+        }
+        break;
+    }
+
+    trimBufferViewCacheBucket(grDevice, bucket);
+
+    // Sweep the other buckets round-robin so that views of long-lived memory expire too
+    BufferViewCacheBucket* sweptBucket =
+        &grDevice->bufferViewCache[grDevice->bufferViewReleaseCount %
+                                   BUFFER_VIEW_CACHE_BUCKET_COUNT];
+    if (sweptBucket != bucket) {
+        trimBufferViewCacheBucket(grDevice, sweptBucket);
+    }
+
+    ReleaseSRWLockExclusive(&grDevice->bufferViewLock);
+}
+
+void grDeviceEvictBufferViews(
+    GrDevice* grDevice,
+    VkBuffer vkBuffer)
+{
+    AcquireSRWLockExclusive(&grDevice->bufferViewLock);
+
+    for (unsigned i = 0; i < BUFFER_VIEW_CACHE_BUCKET_COUNT; i++) {
+        BufferViewCacheBucket* bucket = &grDevice->bufferViewCache[i];
+
+        for (unsigned j = 0; j < bucket->entryCount;) {
+            BufferViewCacheEntry* entry = &bucket->entries[j];
+
+            if (entry->buffer != vkBuffer) {
+                j++;
+            } else if (entry->refCount == 0) {
+                removeBufferViewCacheEntry(grDevice, bucket, j);
+            } else {
+                // Still attached, destroyed on release. The handle may get reused by a new buffer.
+                entry->buffer = VK_NULL_HANDLE;
+                j++;
+            }
+        }
+    }
+
+    ReleaseSRWLockExclusive(&grDevice->bufferViewLock);
+}
+
+void grDeviceDestroyBufferViews(
+    GrDevice* grDevice)
+{
+    for (unsigned i = 0; i < BUFFER_VIEW_CACHE_BUCKET_COUNT; i++) {
+        BufferViewCacheBucket* bucket = &grDevice->bufferViewCache[i];
+
+        for (unsigned j = 0; j < bucket->entryCount; j++) {
+            VKD.vkDestroyBufferView(grDevice->device, bucket->entries[j].bufferView, NULL);
+        }
+
+        free(bucket->entries);
+    }
+
+    free(grDevice->bufferViewCache);
+    grDevice->bufferViewCache = NULL;
+}
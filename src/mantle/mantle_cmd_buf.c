@@ -1,126 +1,190 @@
 #include "mantle_internal.h"
 #include "amdilc.h"
 
-#define SETS_PER_POOL   (2048)
-
 typedef enum _DirtyFlags {
-    FLAG_DIRTY_DESCRIPTOR_SETS      = 1u << 0,
-    FLAG_DIRTY_RENDER_PASS          = 1u << 1,
-    FLAG_DIRTY_PIPELINE             = 1u << 2,
-    FLAG_DIRTY_DYNAMIC_OFFSET       = 1u << 3,
+    FLAG_DIRTY_RENDER_PASS          = 1u << 0,
+    FLAG_DIRTY_PIPELINE             = 1u << 1,
+    FLAG_DIRTY_DYNAMIC_OFFSET       = 1u << 2,
 } DirtyFlags;
 
-static VkDescriptorPool getVkDescriptorPool(
-    const GrDevice* grDevice)
+typedef enum _DynamicStateFlags {
+    DYNAMIC_STATE_VIEWPORT          = 1u << 0,
+    DYNAMIC_STATE_RASTER            = 1u << 1,
+    DYNAMIC_STATE_DEPTH_STENCIL     = 1u << 2,
+    DYNAMIC_STATE_COLOR_BLEND       = 1u << 3,
+    DYNAMIC_STATE_MSAA              = 1u << 4,
+} DynamicStateFlags;
+
+static const DescriptorSetSlot* getDescriptorSetSlot(
+    const GrDescriptorSet* grDescriptorSet,
+    unsigned slotOffset,
+    const DescriptorSlotPath* path)
 {
-    VkDescriptorPool descriptorPool = VK_NULL_HANDLE;
+    if (path->depth == 0) {
+        return NULL;
+    }
 
-    // TODO rebalance
-    const VkDescriptorPoolSize poolSizes[] = {
-        { VK_DESCRIPTOR_TYPE_SAMPLER,                   SETS_PER_POOL },
-        { VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE,             SETS_PER_POOL },
-        { VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,             SETS_PER_POOL },
-        { VK_DESCRIPTOR_TYPE_UNIFORM_TEXEL_BUFFER,      SETS_PER_POOL },
-        { VK_DESCRIPTOR_TYPE_STORAGE_TEXEL_BUFFER,      SETS_PER_POOL },
-        { VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,            SETS_PER_POOL },
-        { VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC,    SETS_PER_POOL },
-    };
+    const DescriptorSetSlot* slot = &grDescriptorSet->slots[slotOffset + path->slotOffsets[0]];
 
-    const VkDescriptorPoolCreateInfo createInfo = {
-        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
-        .pNext = NULL,
-        .flags = 0,
-        .maxSets = SETS_PER_POOL,
-        .poolSizeCount = COUNT_OF(poolSizes),
-        .pPoolSizes = poolSizes,
-    };
+    for (unsigned i = 1; i < path->depth; i++) {
+        if (slot->type == SLOT_TYPE_NONE) {
+            return NULL;
+        } else if (slot->type != SLOT_TYPE_NESTED) {
+            LOGE("unexpected slot type %d (should be nested)\n", slot->type);
+            assert(false);
+        }
 
-    VkResult res = VKD.vkCreateDescriptorPool(grDevice->device, &createInfo, NULL, &descriptorPool);
-    if (res != VK_SUCCESS) {
-        LOGE("vkCreateDescriptorPool failed (%d)\n", res);
-        assert(false);
+        slot = &slot->nested.nextSet->slots[slot->nested.slotOffset + path->slotOffsets[i]];
     }
 
-    return descriptorPool;
+    return slot;
 }
 
-static const DescriptorSetSlot* getDescriptorSetSlot(
-    const GrDescriptorSet* grDescriptorSet,
-    unsigned slotOffset,
-    const GR_DESCRIPTOR_SET_MAPPING* mapping,
-    uint32_t bindingIndex)
+static bool isDynamicMemoryViewBinding(
+    const GR_PIPELINE_SHADER* shaderInfo,
+    const IlcBinding* binding)
 {
-    for (unsigned i = 0; i < mapping->descriptorCount; i++) {
-        const GR_DESCRIPTOR_SLOT_INFO* slotInfo = &mapping->pDescriptorInfo[i];
-        const DescriptorSetSlot* slot = &grDescriptorSet->slots[slotOffset + i];
+    const GR_DYNAMIC_MEMORY_VIEW_SLOT_INFO* dynamicMapping = &shaderInfo->dynamicMemoryViewMapping;
 
-        if (slotInfo->slotObjectType == GR_SLOT_UNUSED) {
-            continue;
-        } else if (slotInfo->slotObjectType == GR_SLOT_NEXT_DESCRIPTOR_SET) {
-            if (slot->type == SLOT_TYPE_NONE) {
-                continue;
-            } else if (slot->type != SLOT_TYPE_NESTED) {
-                LOGE("unexpected slot type %d (should be nested)\n", slot->type);
-                assert(false);
-            }
+    return dynamicMapping->slotObjectType != GR_SLOT_UNUSED &&
+           binding->index == (ILC_BASE_RESOURCE_ID + dynamicMapping->shaderEntityIndex);
+}
 
-            const DescriptorSetSlot* nestedSlot =
-                getDescriptorSetSlot(slot->nested.nextSet, slot->nested.slotOffset,
-                                     slotInfo->pNextLevelSet, bindingIndex);
-            if (nestedSlot != NULL) {
-                return nestedSlot;
-            } else {
-                continue;
-            }
-        }
+static VkDescriptorSet allocateVkDescriptorSet(
+    GrCmdBuffer* grCmdBuffer,
+    VkDescriptorSetLayout vkDescriptorSetLayout,
+    const DescriptorPoolUsage* usage)
+{
+    GrDevice* grDevice = GET_OBJ_DEVICE(grCmdBuffer);
+    VkDescriptorSet vkDescriptorSet = VK_NULL_HANDLE;
+    VkResult vkRes;
 
-        uint32_t slotBinding = slotInfo->shaderEntityIndex;
-        if (slotInfo->slotObjectType == GR_SLOT_SHADER_SAMPLER) {
-            slotBinding += ILC_BASE_SAMPLER_ID;
-        } else {
-            slotBinding += ILC_BASE_RESOURCE_ID;
+    for (unsigned i = 0; i < 2; i++) {
+        if (grCmdBuffer->descriptorPoolCount == 0 || i > 0) {
+            // Get a pool from the device
+            grCmdBuffer->descriptorPoolCount++;
+            grCmdBuffer->descriptorPools = realloc(grCmdBuffer->descriptorPools,
+                                                   grCmdBuffer->descriptorPoolCount *
+                                                   sizeof(VkDescriptorPool));
+            grCmdBuffer->descriptorPools[grCmdBuffer->descriptorPoolCount - 1] =
+                grDeviceAcquireDescriptorPool(grDevice);
         }
 
-        if (slotBinding == bindingIndex) {
-            return slot;
+        const VkDescriptorSetAllocateInfo descSetAllocateInfo = {
+            .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
+            .pNext = NULL,
+            .descriptorPool = grCmdBuffer->descriptorPools[grCmdBuffer->descriptorPoolCount - 1],
+            .descriptorSetCount = 1,
+            .pSetLayouts = &vkDescriptorSetLayout,
+        };
+
+        vkRes = VKD.vkAllocateDescriptorSets(grDevice->device, &descSetAllocateInfo,
+                                             &vkDescriptorSet);
+        if (vkRes == VK_SUCCESS) {
+            break;
+        } else if (vkRes != VK_ERROR_OUT_OF_POOL_MEMORY &&
+                   vkRes != VK_ERROR_FRAGMENTED_POOL) {
+            LOGE("vkAllocateDescriptorSets failed (%d)\n", vkRes);
+            return VK_NULL_HANDLE;
+        } else if (i > 0) {
+            LOGE("descriptor set allocation failed with a new pool\n");
+            assert(false);
         }
     }
 
-    return NULL;
+    // Track usage to size future pools
+    DescriptorPoolUsage* cmdBufferUsage = &grCmdBuffer->descriptorPoolUsage;
+
+    cmdBufferUsage->setCount += usage->setCount;
+    for (unsigned i = 0; i < DESCRIPTOR_POOL_TYPE_COUNT; i++) {
+        cmdBufferUsage->descriptorCounts[i] += usage->descriptorCounts[i];
+        cmdBufferUsage->maxDescriptorCounts[i] = MAX(cmdBufferUsage->maxDescriptorCounts[i],
+                                                     usage->maxDescriptorCounts[i]);
+    }
+
+    return vkDescriptorSet;
 }
 
-static void updateVkDescriptorSet(
-    const GrDevice* grDevice,
+static DescriptorSetCacheBucket* getDescriptorSetCacheBucket(
     GrCmdBuffer* grCmdBuffer,
-    VkDescriptorSet vkDescriptorSet,
-    VkPipelineLayout vkPipelineLayout,
+    VkDescriptorSetLayout vkDescriptorSetLayout,
+    uint64_t hash)
+{
+    uint64_t bucketHash = getHash(hash, &vkDescriptorSetLayout, sizeof(vkDescriptorSetLayout));
+
+    return &grCmdBuffer->descriptorSetCache[bucketHash % DESCRIPTOR_SET_CACHE_BUCKET_COUNT];
+}
+
+static VkDescriptorSet findCachedVkDescriptorSet(
+    const DescriptorSetCacheBucket* bucket,
+    VkDescriptorSetLayout vkDescriptorSetLayout,
+    uint64_t hash,
+    unsigned descriptorCount,
+    const DescriptorInfo* descriptors)
+{
+    for (unsigned i = 0; i < bucket->entryCount; i++) {
+        const DescriptorSetCacheEntry* entry = &bucket->entries[i];
+
+        if (entry->layout == vkDescriptorSetLayout &&
+            entry->hash == hash &&
+            entry->descriptorCount == descriptorCount &&
+            !memcmp(entry->descriptors, descriptors, descriptorCount * sizeof(DescriptorInfo))) {
+            return entry->descriptorSet;
+        }
+    }
+
+    return VK_NULL_HANDLE;
+}
+
+static void cacheVkDescriptorSet(
+    DescriptorSetCacheBucket* bucket,
+    VkDescriptorSetLayout vkDescriptorSetLayout,
+    uint64_t hash,
+    unsigned descriptorCount,
+    const DescriptorInfo* descriptors,
+    VkDescriptorSet vkDescriptorSet)
+{
+    DescriptorInfo* descriptorsCopy = malloc(descriptorCount * sizeof(DescriptorInfo));
+    memcpy(descriptorsCopy, descriptors, descriptorCount * sizeof(DescriptorInfo));
+
+    bucket->entryCount++;
+    bucket->entries = realloc(bucket->entries,
+                              bucket->entryCount * sizeof(DescriptorSetCacheEntry));
+    bucket->entries[bucket->entryCount - 1] = (DescriptorSetCacheEntry) {
+        .layout = vkDescriptorSetLayout,
+        .hash = hash,
+        .descriptorCount = descriptorCount,
+        .descriptors = descriptorsCopy,
+        .descriptorSet = vkDescriptorSet,
+    };
+}
+
+static void getDescriptorInfos(
+    DescriptorInfo* descriptors,
+    uint32_t* strideMask,
+    uint32_t* strides,
+    const GrCmdBuffer* grCmdBuffer,
     unsigned slotOffset,
     const GR_PIPELINE_SHADER* shaderInfo,
+    const DescriptorSlotPath* slotPaths,
     const GrDescriptorSet* grDescriptorSet,
     const DescriptorSetSlot* dynamicMemoryView)
 {
     const GrShader* grShader = (GrShader*)shaderInfo->shader;
-    const GR_DYNAMIC_MEMORY_VIEW_SLOT_INFO* dynamicMapping = &shaderInfo->dynamicMemoryViewMapping;
+    unsigned bindingCount = grShader != NULL ? grShader->bindingCount : 0;
 
-    if (grShader == NULL) {
-        // Nothing to update
-        return;
-    }
+    memset(descriptors, 0, bindingCount * sizeof(DescriptorInfo));
 
-    STACK_ARRAY(VkWriteDescriptorSet, writes, 64, grShader->bindingCount);
-
-    for (unsigned i = 0; i < grShader->bindingCount; i++) {
+    for (unsigned i = 0; i < bindingCount; i++) {
         const IlcBinding* binding = &grShader->bindings[i];
         const DescriptorSetSlot* slot;
 
-        if (dynamicMapping->slotObjectType != GR_SLOT_UNUSED &&
-            (binding->index == (ILC_BASE_RESOURCE_ID + dynamicMapping->shaderEntityIndex))) {
+        if (isDynamicMemoryViewBinding(shaderInfo, binding)) {
             slot = dynamicMemoryView;
         } else if (binding->index == ILC_ATOMIC_COUNTER_ID) {
             slot = &grCmdBuffer->atomicCounterSlot;
         } else {
-            slot = getDescriptorSetSlot(grDescriptorSet, slotOffset,
-                                        &shaderInfo->descriptorSetMapping[0], binding->index);
+            slot = getDescriptorSetSlot(grDescriptorSet, slotOffset, &slotPaths[i]);
         }
 
         if (slot == NULL) {
@@ -128,34 +192,552 @@ static void updateVkDescriptorSet(
             assert(false);
         }
 
-        writes[i] = (VkWriteDescriptorSet) {
-            .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
-            .pNext = NULL,
-            .dstSet = vkDescriptorSet,
-            .dstBinding = binding->index,
-            .dstArrayElement = 0,
-            .descriptorCount = 1,
-            .descriptorType = slot == dynamicMemoryView ? VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC
-                                                        : binding->descriptorType,
-            .pImageInfo = &slot->image.imageInfo,
-            .pBufferInfo = &slot->buffer.bufferInfo,
-            .pTexelBufferView = &slot->buffer.bufferView,
-        };
+        // Slots hold descriptors in their final form since attach time
+        if (slot->type == SLOT_TYPE_IMAGE || slot->type == SLOT_TYPE_BUFFER) {
+            memcpy(&descriptors[i], &slot->descriptor.info, sizeof(DescriptorInfo));
+        }
 
         if (slot->type == SLOT_TYPE_BUFFER && binding->strideIndex >= 0) {
-            // Pass buffer stride through push constants
-            uint32_t stride = slot->buffer.stride;
+            // Buffer strides are passed through push constants
+            *strideMask |= 1u << binding->strideIndex;
+            strides[binding->strideIndex] = slot->descriptor.stride;
+        }
+    }
+}
+
+static void pushStrideConstants(
+    GrCmdBuffer* grCmdBuffer,
+    VkPipelineLayout vkPipelineLayout,
+    uint32_t strideMask,
+    const uint32_t* strides)
+{
+    const GrDevice* grDevice = GET_OBJ_DEVICE(grCmdBuffer);
+    uint32_t dirtyMask = 0;
+
+    for (unsigned i = 0; i < ILC_MAX_STRIDE_CONSTANTS; i++) {
+        if ((strideMask & (1u << i)) &&
+            (!(grCmdBuffer->strideConstantMask & (1u << i)) ||
+             grCmdBuffer->strideConstants[i] != strides[i])) {
+            grCmdBuffer->strideConstants[i] = strides[i];
+            dirtyMask |= 1u << i;
+        }
+    }
+
+    grCmdBuffer->strideConstantMask |= dirtyMask;
+
+    // Emit one push per contiguous run of changed constants
+    for (unsigned i = 0; i < ILC_MAX_STRIDE_CONSTANTS;) {
+        if (!(dirtyMask & (1u << i))) {
+            i++;
+            continue;
+        }
+
+        unsigned first = i;
+        while (i < ILC_MAX_STRIDE_CONSTANTS && (dirtyMask & (1u << i))) {
+            i++;
+        }
+
+        VKD.vkCmdPushConstants(grCmdBuffer->commandBuffer, vkPipelineLayout,
+                               VK_SHADER_STAGE_VERTEX_BIT, first * sizeof(uint32_t),
+                               (i - first) * sizeof(uint32_t),
+                               &grCmdBuffer->strideConstants[first]);
+    }
+}
+
+static VkDescriptorSet getVkDescriptorSet(
+    GrCmdBuffer* grCmdBuffer,
+    VkDescriptorSetLayout vkDescriptorSetLayout,
+    VkDescriptorUpdateTemplate vkDescriptorUpdateTemplate,
+    const DescriptorPoolUsage* usage,
+    unsigned descriptorCount,
+    const DescriptorInfo* descriptors)
+{
+    const GrDevice* grDevice = GET_OBJ_DEVICE(grCmdBuffer);
+
+    // Reuse a descriptor set with identical contents if it was already written
+    uint64_t hash = getHash(HASH_INIT, descriptors, descriptorCount * sizeof(DescriptorInfo));
+    DescriptorSetCacheBucket* bucket =
+        getDescriptorSetCacheBucket(grCmdBuffer, vkDescriptorSetLayout, hash);
+    VkDescriptorSet vkDescriptorSet = findCachedVkDescriptorSet(bucket, vkDescriptorSetLayout, hash,
+                                                                descriptorCount, descriptors);
+
+    if (vkDescriptorSet == VK_NULL_HANDLE) {
+        vkDescriptorSet = allocateVkDescriptorSet(grCmdBuffer, vkDescriptorSetLayout, usage);
+
+        // The template reads the descriptors straight from the resolved array
+        if (vkDescriptorUpdateTemplate != VK_NULL_HANDLE) {
+            VKD.vkUpdateDescriptorSetWithTemplate(grDevice->device, vkDescriptorSet,
+                                                  vkDescriptorUpdateTemplate, descriptors);
+        }
+
+        cacheVkDescriptorSet(bucket, vkDescriptorSetLayout, hash, descriptorCount, descriptors,
+                             vkDescriptorSet);
+    }
+
+    return vkDescriptorSet;
+}
+
+static DescriptorSetSourceKey getDescriptorSetSourceKey(
+    VkDescriptorSetLayout vkDescriptorSetLayout,
+    const BindPoint* bindPoint)
+{
+    DescriptorSetSourceKey key;
+
+    // Clear padding for raw comparison
+    memset(&key, 0, sizeof(key));
+    key.layout = vkDescriptorSetLayout;
+    key.grDescriptorSet = bindPoint->grDescriptorSet;
+    key.slotOffset = bindPoint->slotOffset;
+    key.dynamicBuffer = bindPoint->dynamicMemoryView.descriptor.info.buffer.buffer;
+    key.dynamicRange = bindPoint->dynamicMemoryView.descriptor.info.buffer.range;
+    key.dynamicStride = bindPoint->dynamicMemoryView.descriptor.stride;
+
+    return key;
+}
+
+static DescriptorSetSourceBucket* getDescriptorSetSourceBucket(
+    GrCmdBuffer* grCmdBuffer,
+    const DescriptorSetSourceKey* key)
+{
+    uint64_t hash = getHash(HASH_INIT, key, sizeof(*key));
+
+    return &grCmdBuffer->descriptorSetSourceCache[hash % DESCRIPTOR_SET_CACHE_BUCKET_COUNT];
+}
+
+static const DescriptorSetSourceEntry* findDescriptorSetSource(
+    const DescriptorSetSourceBucket* bucket,
+    const DescriptorSetSourceKey* key,
+    LONG descriptorWriteCount)
+{
+    for (unsigned i = 0; i < bucket->entryCount; i++) {
+        const DescriptorSetSourceEntry* entry = &bucket->entries[i];
+
+        if (entry->descriptorWriteCount == descriptorWriteCount &&
+            !memcmp(&entry->key, key, sizeof(*key))) {
+            return entry;
+        }
+    }
+
+    return NULL;
+}
+
+static void cacheDescriptorSetSource(
+    DescriptorSetSourceBucket* bucket,
+    const DescriptorSetSourceEntry* newEntry)
+{
+    // Overwrite a stale entry if there's one
+    for (unsigned i = 0; i < bucket->entryCount; i++) {
+        if (bucket->entries[i].descriptorWriteCount != newEntry->descriptorWriteCount) {
+            bucket->entries[i] = *newEntry;
+            return;
+        }
+    }
+
+    bucket->entryCount++;
+    bucket->entries = realloc(bucket->entries,
+                              bucket->entryCount * sizeof(DescriptorSetSourceEntry));
+    bucket->entries[bucket->entryCount - 1] = *newEntry;
+}
+
+static bool isReadOnlyAccess(
+    VkAccessFlags accessMask)
+{
+    const VkAccessFlags writeAccessMask = VK_ACCESS_SHADER_WRITE_BIT |
+                                          VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT |
+                                          VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT |
+                                          VK_ACCESS_TRANSFER_WRITE_BIT |
+                                          VK_ACCESS_HOST_WRITE_BIT |
+                                          VK_ACCESS_MEMORY_WRITE_BIT;
+
+    return (accessMask & writeAccessMask) == 0;
+}
+
+static ResourceStateBucket* getResourceStateBucket(
+    GrCmdBuffer* grCmdBuffer,
+    uint64_t handle)
+{
+    uint64_t hash = getHash(HASH_INIT, &handle, sizeof(handle));
+
+    return &grCmdBuffer->resourceStates[hash % RESOURCE_STATE_BUCKET_COUNT];
+}
+
+static bool isRangeOverlapping(
+    uint64_t offsetA,
+    uint64_t countA,
+    uint64_t offsetB,
+    uint64_t countB,
+    uint64_t remainingCount)
+{
+    uint64_t endA = countA == remainingCount ? UINT64_MAX : offsetA + countA;
+    uint64_t endB = countB == remainingCount ? UINT64_MAX : offsetB + countB;
+
+    return offsetA < endB && offsetB < endA;
+}
+
+static bool trackImageState(
+    GR_IMAGE_STATE* trackedState,
+    GrCmdBuffer* grCmdBuffer,
+    VkImage vkImage,
+    const VkImageSubresourceRange* range,
+    GR_IMAGE_STATE newState)
+{
+    ResourceStateBucket* bucket = getResourceStateBucket(grCmdBuffer, (uint64_t)vkImage);
+    bool isTracked = false;
+
+    // Forget about every overlapping range, only exact matches are tracked
+    for (unsigned i = 0; i < bucket->imageEntryCount;) {
+        const ImageStateEntry* entry = &bucket->imageEntries[i];
+
+        if (entry->image != vkImage ||
+            !(entry->range.aspectMask & range->aspectMask) ||
+            !isRangeOverlapping(entry->range.baseMipLevel, entry->range.levelCount,
+                                range->baseMipLevel, range->levelCount,
+                                VK_REMAINING_MIP_LEVELS) ||
+            !isRangeOverlapping(entry->range.baseArrayLayer, entry->range.layerCount,
+                                range->baseArrayLayer, range->layerCount,
+                                VK_REMAINING_ARRAY_LAYERS)) {
+            i++;
+            continue;
+        }
+
+        if (!memcmp(&entry->range, range, sizeof(*range))) {
+            *trackedState = entry->state;
+            isTracked = true;
+        }
+
+        bucket->imageEntryCount--;
+        bucket->imageEntries[i] = bucket->imageEntries[bucket->imageEntryCount];
+    }
+
+    bucket->imageEntryCount++;
+    bucket->imageEntries = realloc(bucket->imageEntries,
+                                   bucket->imageEntryCount * sizeof(ImageStateEntry));
+    bucket->imageEntries[bucket->imageEntryCount - 1] = (ImageStateEntry) {
+        .image = vkImage,
+        .range = *range,
+        .state = newState,
+    };
+
+    return isTracked;
+}
+
+static bool trackMemoryState(
+    GR_MEMORY_STATE* trackedState,
+    GrCmdBuffer* grCmdBuffer,
+    VkBuffer vkBuffer,
+    VkDeviceSize offset,
+    VkDeviceSize size,
+    GR_MEMORY_STATE newState)
+{
+    ResourceStateBucket* bucket = getResourceStateBucket(grCmdBuffer, (uint64_t)vkBuffer);
+    bool isTracked = false;
+
+    for (unsigned i = 0; i < bucket->memoryEntryCount;) {
+        const MemoryStateEntry* entry = &bucket->memoryEntries[i];
+
+        if (entry->buffer != vkBuffer ||
+            !isRangeOverlapping(entry->offset, entry->size, offset, size, VK_WHOLE_SIZE)) {
+            i++;
+            continue;
+        }
+
+        if (entry->offset == offset && entry->size == size) {
+            *trackedState = entry->state;
+            isTracked = true;
+        }
+
+        bucket->memoryEntryCount--;
+        bucket->memoryEntries[i] = bucket->memoryEntries[bucket->memoryEntryCount];
+    }
+
+    bucket->memoryEntryCount++;
+    bucket->memoryEntries = realloc(bucket->memoryEntries,
+                                    bucket->memoryEntryCount * sizeof(MemoryStateEntry));
+    bucket->memoryEntries[bucket->memoryEntryCount - 1] = (MemoryStateEntry) {
+        .buffer = vkBuffer,
+        .offset = offset,
+        .size = size,
+        .state = newState,
+    };
+
+    return isTracked;
+}
+
+static bool isReadOnlyTransitionRedundant(
+    VkPipelineStageFlags oldStageMask,
+    VkAccessFlags oldAccessMask,
+    VkPipelineStageFlags newStageMask,
+    VkAccessFlags newAccessMask)
+{
+    // Nothing to make visible and no hazard, as long as the new scope was already covered
+    return isReadOnlyAccess(oldAccessMask) && isReadOnlyAccess(newAccessMask) &&
+           (newStageMask & ~oldStageMask) == 0 && (newAccessMask & ~oldAccessMask) == 0;
+}
+
+static bool isImageTransitionRedundant(
+    GR_IMAGE_STATE oldState,
+    GR_IMAGE_STATE newState,
+    bool isDepthStencil,
+    bool isTracked,
+    GR_IMAGE_STATE trackedState)
+{
+    VkImageLayout newLayout = getVkImageLayout(newState, isDepthStencil);
+    VkAccessFlags newAccessMask = getVkAccessFlagsImage(newState, isDepthStencil);
+
+    if (newLayout == VK_IMAGE_LAYOUT_UNDEFINED || !isReadOnlyAccess(newAccessMask)) {
+        return false;
+    } else if (isTracked && trackedState == newState) {
+        // Already transitioned earlier in this command buffer, and nothing could write since
+        return true;
+    }
+
+    return getVkImageLayout(oldState, isDepthStencil) == newLayout &&
+           isReadOnlyTransitionRedundant(getVkPipelineStageFlagsImage(oldState),
+                                         getVkAccessFlagsImage(oldState, isDepthStencil),
+                                         getVkPipelineStageFlagsImage(newState),
+                                         newAccessMask);
+}
+
+static bool isMemoryTransitionRedundant(
+    GR_MEMORY_STATE oldState,
+    GR_MEMORY_STATE newState,
+    bool isTracked,
+    GR_MEMORY_STATE trackedState)
+{
+    VkAccessFlags newAccessMask = getVkAccessFlagsMemory(newState);
+
+    if (newState == GR_MEMORY_STATE_DISCARD || !isReadOnlyAccess(newAccessMask)) {
+        return false;
+    } else if (isTracked && trackedState == newState) {
+        return true;
+    }
+
+    return isReadOnlyTransitionRedundant(getVkPipelineStageFlagsMemory(oldState),
+                                         getVkAccessFlagsMemory(oldState),
+                                         getVkPipelineStageFlagsMemory(newState),
+                                         newAccessMask);
+}
+
+static bool isMemoryReferenced(
+    GrCmdBuffer* grCmdBuffer,
+    VkBuffer vkBuffer)
+{
+    const ResourceStateBucket* bucket = getResourceStateBucket(grCmdBuffer, (uint64_t)vkBuffer);
+
+    for (unsigned i = 0; i < bucket->memoryEntryCount; i++) {
+        if (bucket->memoryEntries[i].buffer == vkBuffer) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static void markMemoryReferenced(
+    GrCmdBuffer* grCmdBuffer,
+    VkBuffer vkBuffer)
+{
+    if (isMemoryReferenced(grCmdBuffer, vkBuffer)) {
+        return;
+    }
+
+    ResourceStateBucket* bucket = getResourceStateBucket(grCmdBuffer, (uint64_t)vkBuffer);
+
+    // An empty range never overlaps nor matches a prepared range
+    bucket->memoryEntryCount++;
+    bucket->memoryEntries = realloc(bucket->memoryEntries,
+                                    bucket->memoryEntryCount * sizeof(MemoryStateEntry));
+    bucket->memoryEntries[bucket->memoryEntryCount - 1] = (MemoryStateEntry) {
+        .buffer = vkBuffer,
+        .offset = 0,
+        .size = 0,
+        .state = GR_MEMORY_STATE_DATA_TRANSFER,
+    };
+}
+
+static VkCommandBuffer getMemoryWriteCommandBuffer(
+    GrCmdBuffer* grCmdBuffer,
+    VkBuffer vkBuffer)
+{
+    const GrDevice* grDevice = GET_OBJ_DEVICE(grCmdBuffer);
+
+    // Memory that nothing referenced so far in this command buffer can be written ahead of it,
+    // which saves restarting the render pass
+    if (grCmdBuffer->isRendering && !isMemoryReferenced(grCmdBuffer, vkBuffer)) {
+        if (!grCmdBuffer->hasSetupCommands) {
+            const VkCommandBufferBeginInfo beginInfo = {
+                .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+                .pNext = NULL,
+                .flags = 0,
+                .pInheritanceInfo = NULL,
+            };
+
+            VkResult res = VKD.vkBeginCommandBuffer(grCmdBuffer->setupCommandBuffer, &beginInfo);
+            if (res != VK_SUCCESS) {
+                // Record into the main command buffer instead
+                LOGE("vkBeginCommandBuffer failed (%d)\n", res);
+            } else {
+                grCmdBuffer->hasSetupCommands = true;
+            }
+        }
+
+        if (grCmdBuffer->hasSetupCommands) {
+            markMemoryReferenced(grCmdBuffer, vkBuffer);
+            return grCmdBuffer->setupCommandBuffer;
+        }
+    }
+
+    markMemoryReferenced(grCmdBuffer, vkBuffer);
+    grCmdBufferEndRenderPass(grCmdBuffer);
+    grCmdBufferFlushBarriers(grCmdBuffer);
+
+    return grCmdBuffer->commandBuffer;
+}
+
+static void queuePendingClear(
+    GrCmdBuffer* grCmdBuffer,
+    VkImage vkImage,
+    const VkImageSubresourceRange* range,
+    const VkClearValue* clearValue)
+{
+    grCmdBuffer->pendingClearCount++;
+    grCmdBuffer->pendingClears = realloc(grCmdBuffer->pendingClears,
+                                         grCmdBuffer->pendingClearCount * sizeof(PendingClear));
+    grCmdBuffer->pendingClears[grCmdBuffer->pendingClearCount - 1] = (PendingClear) {
+        .image = vkImage,
+        .range = *range,
+        .clearValue = *clearValue,
+    };
+}
+
+static void emitPendingClears(
+    GrCmdBuffer* grCmdBuffer)
+{
+    const GrDevice* grDevice = GET_OBJ_DEVICE(grCmdBuffer);
+
+    for (unsigned i = 0; i < grCmdBuffer->pendingClearCount; i++) {
+        const PendingClear* pendingClear = &grCmdBuffer->pendingClears[i];
+
+        if (pendingClear->range.aspectMask == VK_IMAGE_ASPECT_COLOR_BIT) {
+            VKD.vkCmdClearColorImage(grCmdBuffer->commandBuffer, pendingClear->image,
+                                     getVkImageLayout(GR_IMAGE_STATE_CLEAR, false),
+                                     &pendingClear->clearValue.color, 1, &pendingClear->range);
+        } else {
+            VKD.vkCmdClearDepthStencilImage(grCmdBuffer->commandBuffer, pendingClear->image,
+                                            getVkImageLayout(GR_IMAGE_STATE_CLEAR, false),
+                                            &pendingClear->clearValue.depthStencil,
+                                            1, &pendingClear->range);
+        }
+    }
+
+    grCmdBuffer->pendingClearCount = 0;
+}
+
+static void foldPendingClear(
+    GrCmdBuffer* grCmdBuffer,
+    VkRenderingAttachmentInfoKHR* attachment,
+    VkImage vkImage,
+    const VkImageSubresourceRange* viewRange,
+    VkImageAspectFlags aspectMask)
+{
+    // Only the last clear of the image can be moved past the others
+    for (unsigned i = grCmdBuffer->pendingClearCount; i-- > 0;) {
+        PendingClear* pendingClear = &grCmdBuffer->pendingClears[i];
+
+        if (pendingClear->image != vkImage || !(pendingClear->range.aspectMask & aspectMask)) {
+            continue;
+        }
+
+        if (pendingClear->range.baseMipLevel == viewRange->baseMipLevel &&
+            pendingClear->range.levelCount == viewRange->levelCount &&
+            pendingClear->range.baseArrayLayer == viewRange->baseArrayLayer &&
+            pendingClear->range.layerCount == viewRange->layerCount) {
+            attachment->loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+            attachment->clearValue = pendingClear->clearValue;
+
+            // Combined depth-stencil clears are folded one aspect at a time
+            pendingClear->range.aspectMask &= ~aspectMask;
+            if (pendingClear->range.aspectMask == 0) {
+                grCmdBuffer->pendingClearCount--;
+                memmove(&grCmdBuffer->pendingClears[i], &grCmdBuffer->pendingClears[i + 1],
+                        (grCmdBuffer->pendingClearCount - i) * sizeof(PendingClear));
+            }
+        }
+        break;
+    }
+}
 
-            VKD.vkCmdPushConstants(grCmdBuffer->commandBuffer, vkPipelineLayout,
-                                   VK_SHADER_STAGE_VERTEX_BIT,
-                                   binding->strideIndex * sizeof(uint32_t),
-                                   sizeof(uint32_t), &stride);
+static void grCmdBufferFoldPendingClears(
+    GrCmdBuffer* grCmdBuffer)
+{
+    if (grCmdBuffer->pendingClearCount == 0) {
+        return;
+    }
+
+    // Pending clears end the render pass anyway, the next one can apply them as load ops
+    grCmdBufferEndRenderPass(grCmdBuffer);
+
+    // Clears are only folded if the render area covers the whole view
+    for (unsigned i = 0; i < grCmdBuffer->colorAttachmentCount; i++) {
+        const GrColorTargetView* grColorTargetView = grCmdBuffer->grColorTargetViews[i];
+
+        if (!memcmp(&grColorTargetView->extent, &grCmdBuffer->minExtent, sizeof(VkExtent3D))) {
+            foldPendingClear(grCmdBuffer, &grCmdBuffer->colorAttachments[i],
+                             grColorTargetView->grImage->image,
+                             &grColorTargetView->subresourceRange, VK_IMAGE_ASPECT_COLOR_BIT);
         }
     }
 
-    VKD.vkUpdateDescriptorSets(grDevice->device, grShader->bindingCount, writes, 0, NULL);
+    const GrDepthStencilView* grDepthStencilView = grCmdBuffer->grDepthStencilView;
+
+    if (grCmdBuffer->hasDepthStencil &&
+        !memcmp(&grDepthStencilView->extent, &grCmdBuffer->minExtent, sizeof(VkExtent3D))) {
+        const VkImageSubresourceRange* viewRange = &grDepthStencilView->subresourceRange;
+
+        if (viewRange->aspectMask & VK_IMAGE_ASPECT_DEPTH_BIT) {
+            foldPendingClear(grCmdBuffer, &grCmdBuffer->depthAttachment,
+                             grDepthStencilView->grImage->image, viewRange,
+                             VK_IMAGE_ASPECT_DEPTH_BIT);
+        }
+        if (viewRange->aspectMask & VK_IMAGE_ASPECT_STENCIL_BIT) {
+            foldPendingClear(grCmdBuffer, &grCmdBuffer->stencilAttachment,
+                             grDepthStencilView->grImage->image, viewRange,
+                             VK_IMAGE_ASPECT_STENCIL_BIT);
+        }
+    }
+}
+
+static void grCmdBufferFlushDraws(
+    GrCmdBuffer* grCmdBuffer)
+{
+    const GrDevice* grDevice = GET_OBJ_DEVICE(grCmdBuffer);
+    const MultiDrawInfo* multiDraws = grCmdBuffer->multiDraws;
+
+    if (grCmdBuffer->multiDrawCount == 0) {
+        return;
+    } else if (grCmdBuffer->multiDrawCount == 1 && grCmdBuffer->isMultiDrawIndexed) {
+        VKD.vkCmdDrawIndexed(grCmdBuffer->commandBuffer, multiDraws[0].indexedDraw.indexCount,
+                             grCmdBuffer->multiDrawInstanceCount,
+                             multiDraws[0].indexedDraw.firstIndex,
+                             multiDraws[0].indexedDraw.vertexOffset,
+                             grCmdBuffer->multiDrawFirstInstance);
+    } else if (grCmdBuffer->multiDrawCount == 1) {
+        VKD.vkCmdDraw(grCmdBuffer->commandBuffer, multiDraws[0].draw.vertexCount,
+                      grCmdBuffer->multiDrawInstanceCount, multiDraws[0].draw.firstVertex,
+                      grCmdBuffer->multiDrawFirstInstance);
+    } else if (grCmdBuffer->isMultiDrawIndexed) {
+        VKD.vkCmdDrawMultiIndexedEXT(grCmdBuffer->commandBuffer, grCmdBuffer->multiDrawCount,
+                                     &multiDraws[0].indexedDraw,
+                                     grCmdBuffer->multiDrawInstanceCount,
+                                     grCmdBuffer->multiDrawFirstInstance,
+                                     sizeof(MultiDrawInfo), NULL);
+    } else {
+        VKD.vkCmdDrawMultiEXT(grCmdBuffer->commandBuffer, grCmdBuffer->multiDrawCount,
+                              &multiDraws[0].draw, grCmdBuffer->multiDrawInstanceCount,
+                              grCmdBuffer->multiDrawFirstInstance, sizeof(MultiDrawInfo));
+    }
 
-    STACK_ARRAY_FINISH(writes);
+    grCmdBuffer->multiDrawCount = 0;
 }
 
 static void grCmdBufferBeginRenderPass(
@@ -185,6 +767,13 @@ static void grCmdBufferBeginRenderPass(
 
     VKD.vkCmdBeginRenderingKHR(grCmdBuffer->commandBuffer, &renderingInfo);
     grCmdBuffer->isRendering = true;
+
+    // Folded clears only apply once
+    for (unsigned i = 0; i < grCmdBuffer->colorAttachmentCount; i++) {
+        grCmdBuffer->colorAttachments[i].loadOp = VK_ATTACHMENT_LOAD_OP_LOAD;
+    }
+    grCmdBuffer->depthAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_LOAD;
+    grCmdBuffer->stencilAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_LOAD;
 }
 
 void grCmdBufferEndRenderPass(
@@ -192,6 +781,8 @@ void grCmdBufferEndRenderPass(
 {
     const GrDevice* grDevice = GET_OBJ_DEVICE(grCmdBuffer);
 
+    grCmdBufferFlushDraws(grCmdBuffer);
+
     if (!grCmdBuffer->isRendering) {
         return;
     }
@@ -200,79 +791,321 @@ void grCmdBufferEndRenderPass(
     grCmdBuffer->isRendering = false;
 }
 
-static void grCmdBufferUpdateDescriptorSets(
-    GrCmdBuffer* grCmdBuffer,
-    VkPipelineBindPoint vkBindPoint)
+void grCmdBufferFlushBarriers(
+    GrCmdBuffer* grCmdBuffer)
 {
     const GrDevice* grDevice = GET_OBJ_DEVICE(grCmdBuffer);
-    BindPoint* bindPoint = &grCmdBuffer->bindPoints[vkBindPoint];
-    GrPipeline* grPipeline = bindPoint->grPipeline;
-    VkResult vkRes;
 
-    for (unsigned i = 0; i < 2; i++) {
-        if (grCmdBuffer->descriptorPoolIndex < grCmdBuffer->descriptorPoolCount) {
-            const VkDescriptorSetAllocateInfo descSetAllocateInfo = {
-                .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
+    if (grCmdBuffer->pendingClearCount == 0 &&
+        grCmdBuffer->imageBarrierCount == 0 && grCmdBuffer->bufferBarrierCount == 0) {
+        return;
+    }
+
+    grCmdBufferEndRenderPass(grCmdBuffer);
+
+    // Clears were recorded before the queued barriers
+    emitPendingClears(grCmdBuffer);
+
+    if (grCmdBuffer->imageBarrierCount == 0 && grCmdBuffer->bufferBarrierCount == 0) {
+        return;
+    }
+
+    if (grDevice->hasSynchronization2) {
+        const VkDependencyInfoKHR dependencyInfo = {
+            .sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO_KHR,
+            .pNext = NULL,
+            .dependencyFlags = 0,
+            .memoryBarrierCount = 0,
+            .pMemoryBarriers = NULL,
+            .bufferMemoryBarrierCount = grCmdBuffer->bufferBarrierCount,
+            .pBufferMemoryBarriers = grCmdBuffer->bufferBarriers,
+            .imageMemoryBarrierCount = grCmdBuffer->imageBarrierCount,
+            .pImageMemoryBarriers = grCmdBuffer->imageBarriers,
+        };
+
+        VKD.vkCmdPipelineBarrier2KHR(grCmdBuffer->commandBuffer, &dependencyInfo);
+    } else {
+        // Legacy barriers share a single pair of stage masks
+        STACK_ARRAY(VkBufferMemoryBarrier, bufferBarriers, 128, grCmdBuffer->bufferBarrierCount);
+        STACK_ARRAY(VkImageMemoryBarrier, imageBarriers, 128, grCmdBuffer->imageBarrierCount);
+        VkPipelineStageFlags srcStageMask = 0;
+        VkPipelineStageFlags dstStageMask = 0;
+
+        for (unsigned i = 0; i < grCmdBuffer->bufferBarrierCount; i++) {
+            const VkBufferMemoryBarrier2KHR* barrier = &grCmdBuffer->bufferBarriers[i];
+
+            bufferBarriers[i] = (VkBufferMemoryBarrier) {
+                .sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
                 .pNext = NULL,
-                .descriptorPool = grCmdBuffer->descriptorPools[grCmdBuffer->descriptorPoolIndex],
-                .descriptorSetCount = grPipeline->stageCount, // TODO optimize
-                .pSetLayouts = grPipeline->descriptorSetLayouts,
+                .srcAccessMask = (VkAccessFlags)barrier->srcAccessMask,
+                .dstAccessMask = (VkAccessFlags)barrier->dstAccessMask,
+                .srcQueueFamilyIndex = barrier->srcQueueFamilyIndex,
+                .dstQueueFamilyIndex = barrier->dstQueueFamilyIndex,
+                .buffer = barrier->buffer,
+                .offset = barrier->offset,
+                .size = barrier->size,
             };
 
-            vkRes = VKD.vkAllocateDescriptorSets(grDevice->device, &descSetAllocateInfo,
-                                                 bindPoint->descriptorSets);
-            if (vkRes == VK_SUCCESS) {
-                break;
-            } else if (vkRes != VK_ERROR_OUT_OF_POOL_MEMORY) {
-                LOGE("vkAllocateDescriptorSets failed (%d)\n", vkRes);
-                break;
-            } else if (i > 0) {
-                LOGE("descriptor set allocation failed with a new pool\n");
-                assert(false);
-            } else {
-                // Use the next pool
-                grCmdBuffer->descriptorPoolIndex++;
-            }
+            srcStageMask |= (VkPipelineStageFlags)barrier->srcStageMask;
+            dstStageMask |= (VkPipelineStageFlags)barrier->dstStageMask;
         }
 
-        if (grCmdBuffer->descriptorPoolIndex == grCmdBuffer->descriptorPoolCount) {
-            // Need to allocate a new pool
-            VkDescriptorPool descriptorPool = getVkDescriptorPool(grDevice);
+        for (unsigned i = 0; i < grCmdBuffer->imageBarrierCount; i++) {
+            const VkImageMemoryBarrier2KHR* barrier = &grCmdBuffer->imageBarriers[i];
 
-            // Track descriptor pool
-            grCmdBuffer->descriptorPoolCount++;
-            grCmdBuffer->descriptorPools = realloc(grCmdBuffer->descriptorPools,
-                                                   grCmdBuffer->descriptorPoolCount *
-                                                   sizeof(VkDescriptorPool));
-            grCmdBuffer->descriptorPools[grCmdBuffer->descriptorPoolCount - 1] = descriptorPool;
+            imageBarriers[i] = (VkImageMemoryBarrier) {
+                .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+                .pNext = NULL,
+                .srcAccessMask = (VkAccessFlags)barrier->srcAccessMask,
+                .dstAccessMask = (VkAccessFlags)barrier->dstAccessMask,
+                .oldLayout = barrier->oldLayout,
+                .newLayout = barrier->newLayout,
+                .srcQueueFamilyIndex = barrier->srcQueueFamilyIndex,
+                .dstQueueFamilyIndex = barrier->dstQueueFamilyIndex,
+                .image = barrier->image,
+                .subresourceRange = barrier->subresourceRange,
+            };
+
+            srcStageMask |= (VkPipelineStageFlags)barrier->srcStageMask;
+            dstStageMask |= (VkPipelineStageFlags)barrier->dstStageMask;
+        }
+
+        VKD.vkCmdPipelineBarrier(grCmdBuffer->commandBuffer, srcStageMask, dstStageMask, 0,
+                                 0, NULL, grCmdBuffer->bufferBarrierCount, bufferBarriers,
+                                 grCmdBuffer->imageBarrierCount, imageBarriers);
+
+        STACK_ARRAY_FINISH(bufferBarriers);
+        STACK_ARRAY_FINISH(imageBarriers);
+    }
+
+    grCmdBuffer->imageBarrierCount = 0;
+    grCmdBuffer->bufferBarrierCount = 0;
+}
+
+void grCmdBufferResolveTimestamps(
+    GrCmdBuffer* grCmdBuffer)
+{
+    const GrDevice* grDevice = GET_OBJ_DEVICE(grCmdBuffer);
+    const PendingTimestamp* timestamps = grCmdBuffer->pendingTimestamps;
+    unsigned timestampCount = grCmdBuffer->pendingTimestampCount;
+    // Pending timestamps occupy the last written slots
+    unsigned firstSlot = grCmdBuffer->timestampResetCount - timestampCount;
+    unsigned runStart = 0;
+
+    if (timestampCount == 0) {
+        return;
+    }
+
+    grCmdBufferEndRenderPass(grCmdBuffer);
+    grCmdBufferFlushBarriers(grCmdBuffer);
+
+    // Timestamps written back to back usually land next to each other, copy them at once
+    for (unsigned i = 1; i <= timestampCount; i++) {
+        if (i < timestampCount && timestamps[i].buffer == timestamps[runStart].buffer &&
+            timestamps[i].offset ==
+            timestamps[runStart].offset + (i - runStart) * sizeof(uint64_t)) {
+            continue;
         }
+
+        VKD.vkCmdCopyQueryPoolResults(grCmdBuffer->commandBuffer,
+                                      grCmdBuffer->timestampQueryPool, firstSlot + runStart,
+                                      i - runStart, timestamps[runStart].buffer,
+                                      timestamps[runStart].offset, sizeof(uint64_t),
+                                      VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT);
+        runStart = i;
     }
 
+    grCmdBuffer->pendingTimestampCount = 0;
+}
+
+static void resolveMemoryTimestamps(
+    GrCmdBuffer* grCmdBuffer,
+    VkBuffer buffer)
+{
+    // Timestamps must land before other commands access their memory
+    for (unsigned i = 0; i < grCmdBuffer->pendingTimestampCount; i++) {
+        if (grCmdBuffer->pendingTimestamps[i].buffer == buffer) {
+            grCmdBufferResolveTimestamps(grCmdBuffer);
+            break;
+        }
+    }
+}
+
+static void grCmdBufferUpdateDescriptorSets(
+    GrCmdBuffer* grCmdBuffer,
+    VkPipelineBindPoint vkBindPoint,
+    uint32_t setMask)
+{
+    const GrDevice* grDevice = GET_OBJ_DEVICE(grCmdBuffer);
+    BindPoint* bindPoint = &grCmdBuffer->bindPoints[vkBindPoint];
+    const GrPipeline* grPipeline = bindPoint->grPipeline;
+    uint32_t pipelineStrideMask = 0;
+    uint32_t pipelineStrides[ILC_MAX_STRIDE_CONSTANTS] = { 0 };
+
     for (unsigned i = 0; i < grPipeline->stageCount; i++) {
-        updateVkDescriptorSet(grDevice, grCmdBuffer, bindPoint->descriptorSets[i],
-                              grPipeline->pipelineLayout, bindPoint->slotOffset,
-                              &grPipeline->shaderInfos[i], bindPoint->grDescriptorSet,
-                              &bindPoint->dynamicMemoryView);
+        if (!(setMask & (1u << i))) {
+            continue;
+        }
+
+        const GrShader* grShader = (GrShader*)grPipeline->shaderInfos[i].shader;
+        unsigned bindingCount = grShader != NULL ? grShader->bindingCount : 0;
+        uint32_t strideMask = 0;
+        uint32_t strides[ILC_MAX_STRIDE_CONSTANTS] = { 0 };
+
+        if ((int)i == grPipeline->pushDescriptorSetIndex) {
+            STACK_ARRAY(DescriptorInfo, descriptors, 64, bindingCount);
+
+            getDescriptorInfos(descriptors, &strideMask, strides, grCmdBuffer,
+                               bindPoint->slotOffset, &grPipeline->shaderInfos[i],
+                               grPipeline->descriptorSlotPaths[i], bindPoint->grDescriptorSet,
+                               &bindPoint->dynamicMemoryView);
+
+            // Small sets are pushed directly into the command buffer
+            VKD.vkCmdPushDescriptorSetWithTemplateKHR(grCmdBuffer->commandBuffer,
+                                                      grPipeline->descriptorUpdateTemplates[i],
+                                                      grPipeline->pipelineLayout, i, descriptors);
+            bindPoint->descriptorSets[i] = VK_NULL_HANDLE;
+
+            STACK_ARRAY_FINISH(descriptors);
+        } else {
+            // Skip resolution entirely if no descriptor was written since the last time
+            LONG descriptorWriteCount = grDevice->descriptorWriteCount;
+            MemoryBarrier(); // Pairs with markDescriptorsWritten, slots are read after the count
+            DescriptorSetSourceKey key =
+                getDescriptorSetSourceKey(grPipeline->descriptorSetLayouts[i], bindPoint);
+            DescriptorSetSourceBucket* bucket = getDescriptorSetSourceBucket(grCmdBuffer, &key);
+            const DescriptorSetSourceEntry* entry =
+                findDescriptorSetSource(bucket, &key, descriptorWriteCount);
+
+            if (entry != NULL) {
+                bindPoint->descriptorSets[i] = entry->descriptorSet;
+                strideMask = entry->strideMask;
+                memcpy(strides, entry->strides, sizeof(strides));
+            } else {
+                STACK_ARRAY(DescriptorInfo, descriptors, 64, bindingCount);
+
+                getDescriptorInfos(descriptors, &strideMask, strides, grCmdBuffer,
+                                   bindPoint->slotOffset, &grPipeline->shaderInfos[i],
+                                   grPipeline->descriptorSlotPaths[i], bindPoint->grDescriptorSet,
+                                   &bindPoint->dynamicMemoryView);
+
+                bindPoint->descriptorSets[i] =
+                    getVkDescriptorSet(grCmdBuffer, grPipeline->descriptorSetLayouts[i],
+                                       grPipeline->descriptorUpdateTemplates[i],
+                                       &grPipeline->descriptorPoolUsages[i], bindingCount,
+                                       descriptors);
+
+                DescriptorSetSourceEntry newEntry = {
+                    .key = key,
+                    .descriptorWriteCount = descriptorWriteCount,
+                    .descriptorSet = bindPoint->descriptorSets[i],
+                    .strideMask = strideMask,
+                    .strides = { 0 }, // Initialized below
+                };
+                memcpy(newEntry.strides, strides, sizeof(strides));
+                cacheDescriptorSetSource(bucket, &newEntry);
+
+                STACK_ARRAY_FINISH(descriptors);
+            }
+        }
+
+        // Later stages take precedence, as they did when pushed one by one
+        for (unsigned j = 0; j < ILC_MAX_STRIDE_CONSTANTS; j++) {
+            if (strideMask & (1u << j)) {
+                pipelineStrides[j] = strides[j];
+            }
+        }
+        pipelineStrideMask |= strideMask;
     }
+
+    pushStrideConstants(grCmdBuffer, grPipeline->pipelineLayout, pipelineStrideMask,
+                        pipelineStrides);
 }
 
-static void grCmdBufferBindDescriptorSets(
+static void grCmdBufferBindDescriptorSetRange(
     GrCmdBuffer* grCmdBuffer,
-    VkPipelineBindPoint vkBindPoint)
+    VkPipelineBindPoint vkBindPoint,
+    unsigned firstSet,
+    unsigned setCount)
 {
     const GrDevice* grDevice = GET_OBJ_DEVICE(grCmdBuffer);
     const BindPoint* bindPoint = &grCmdBuffer->bindPoints[vkBindPoint];
     const GrPipeline* grPipeline = bindPoint->grPipeline;
 
+    unsigned dynamicOffsetCount = 0;
     uint32_t dynamicOffsets[MAX_STAGE_COUNT];
 
-    for (unsigned i = 0; i < grPipeline->dynamicOffsetCount; i++) {
-        dynamicOffsets[i] = bindPoint->dynamicOffset;
+    for (unsigned i = firstSet; i < firstSet + setCount; i++) {
+        for (unsigned j = 0; j < grPipeline->dynamicOffsetCounts[i]; j++) {
+            dynamicOffsets[dynamicOffsetCount++] = bindPoint->dynamicOffset;
+        }
     }
 
     VKD.vkCmdBindDescriptorSets(grCmdBuffer->commandBuffer, vkBindPoint, grPipeline->pipelineLayout,
-                                0, grPipeline->stageCount, bindPoint->descriptorSets,
-                                grPipeline->dynamicOffsetCount, dynamicOffsets);
+                                firstSet, setCount, &bindPoint->descriptorSets[firstSet],
+                                dynamicOffsetCount, dynamicOffsets);
+}
+
+static void grCmdBufferBindDescriptorSets(
+    GrCmdBuffer* grCmdBuffer,
+    VkPipelineBindPoint vkBindPoint,
+    uint32_t setMask)
+{
+    const GrPipeline* grPipeline = grCmdBuffer->bindPoints[vkBindPoint].grPipeline;
+
+    if (grPipeline->pushDescriptorSetIndex >= 0) {
+        // Pushed sets aren't bound
+        setMask &= ~(1u << grPipeline->pushDescriptorSetIndex);
+    }
+
+    // Bind each run of consecutive sets at once
+    unsigned firstSet = 0;
+
+    while (firstSet < grPipeline->stageCount) {
+        if (!(setMask & (1u << firstSet))) {
+            firstSet++;
+            continue;
+        }
+
+        unsigned setCount = 1;
+        while (firstSet + setCount < grPipeline->stageCount &&
+               (setMask & (1u << (firstSet + setCount)))) {
+            setCount++;
+        }
+
+        grCmdBufferBindDescriptorSetRange(grCmdBuffer, vkBindPoint, firstSet, setCount);
+        firstSet += setCount;
+    }
+}
+
+static void setStencilFaceState(
+    GrCmdBuffer* grCmdBuffer,
+    VkStencilFaceFlags faceMask,
+    VkStencilOpState* recordedState,
+    const VkStencilOpState* state,
+    bool isRecorded)
+{
+    const GrDevice* grDevice = GET_OBJ_DEVICE(grCmdBuffer);
+
+    if (!isRecorded ||
+        state->failOp != recordedState->failOp ||
+        state->passOp != recordedState->passOp ||
+        state->depthFailOp != recordedState->depthFailOp ||
+        state->compareOp != recordedState->compareOp) {
+        VKD.vkCmdSetStencilOpEXT(grCmdBuffer->commandBuffer, faceMask, state->failOp,
+                                 state->passOp, state->depthFailOp, state->compareOp);
+    }
+    if (!isRecorded || state->compareMask != recordedState->compareMask) {
+        VKD.vkCmdSetStencilCompareMask(grCmdBuffer->commandBuffer, faceMask, state->compareMask);
+    }
+    if (!isRecorded || state->writeMask != recordedState->writeMask) {
+        VKD.vkCmdSetStencilWriteMask(grCmdBuffer->commandBuffer, faceMask, state->writeMask);
+    }
+    if (!isRecorded || state->reference != recordedState->reference) {
+        VKD.vkCmdSetStencilReference(grCmdBuffer->commandBuffer, faceMask, state->reference);
+    }
+
+    *recordedState = *state;
 }
 
 static void grCmdBufferUpdateResources(
@@ -283,13 +1116,27 @@ static void grCmdBufferUpdateResources(
     BindPoint* bindPoint = &grCmdBuffer->bindPoints[vkBindPoint];
     GrPipeline* grPipeline = bindPoint->grPipeline;
     uint32_t dirtyFlags = bindPoint->dirtyFlags;
+    uint32_t dirtySetMask = bindPoint->dirtyDescriptorSetMask;
+    uint32_t bindSetMask = dirtySetMask;
+
+    grCmdBufferFlushDraws(grCmdBuffer);
+
+    if (vkBindPoint == VK_PIPELINE_BIND_POINT_GRAPHICS) {
+        grCmdBufferFoldPendingClears(grCmdBuffer);
+    }
+    grCmdBufferFlushBarriers(grCmdBuffer);
+
+    if (dirtySetMask != 0) {
+        grCmdBufferUpdateDescriptorSets(grCmdBuffer, vkBindPoint, dirtySetMask);
+    }
 
-    if (dirtyFlags & FLAG_DIRTY_DESCRIPTOR_SETS) {
-        grCmdBufferUpdateDescriptorSets(grCmdBuffer, vkBindPoint);
+    if (dirtyFlags & FLAG_DIRTY_DYNAMIC_OFFSET) {
+        // Rebind sets consuming the dynamic offset
+        bindSetMask |= grPipeline->dynamicMemoryViewStageMask;
     }
 
-    if (dirtyFlags & (FLAG_DIRTY_DESCRIPTOR_SETS | FLAG_DIRTY_DYNAMIC_OFFSET)) {
-        grCmdBufferBindDescriptorSets(grCmdBuffer, vkBindPoint);
+    if (bindSetMask != 0) {
+        grCmdBufferBindDescriptorSets(grCmdBuffer, vkBindPoint, bindSetMask);
     }
 
     if (dirtyFlags & FLAG_DIRTY_RENDER_PASS) {
@@ -312,6 +1159,48 @@ static void grCmdBufferUpdateResources(
     }
 
     bindPoint->dirtyFlags = 0;
+    bindPoint->dirtyDescriptorSetMask = 0;
+}
+
+static bool grCmdBufferQueueDraw(
+    GrCmdBuffer* grCmdBuffer,
+    bool isIndexed,
+    uint32_t firstInstance,
+    uint32_t instanceCount,
+    const MultiDrawInfo* drawInfo)
+{
+    const GrDevice* grDevice = GET_OBJ_DEVICE(grCmdBuffer);
+    const BindPoint* bindPoint = &grCmdBuffer->bindPoints[VK_PIPELINE_BIND_POINT_GRAPHICS];
+
+    if (grDevice->maxMultiDrawCount == 0) {
+        return false;
+    }
+
+    bool needsUpdate = bindPoint->dirtyFlags != 0 || bindPoint->dirtyDescriptorSetMask != 0 ||
+                       grCmdBuffer->imageBarrierCount > 0 || grCmdBuffer->bufferBarrierCount > 0 ||
+                       grCmdBuffer->pendingClearCount > 0 || !grCmdBuffer->isRendering;
+
+    if (grCmdBuffer->multiDrawCount > 0 &&
+        (needsUpdate ||
+         isIndexed != grCmdBuffer->isMultiDrawIndexed ||
+         firstInstance != grCmdBuffer->multiDrawFirstInstance ||
+         instanceCount != grCmdBuffer->multiDrawInstanceCount ||
+         grCmdBuffer->multiDrawCount == MIN(MULTI_DRAW_BATCH_SIZE, grDevice->maxMultiDrawCount))) {
+        grCmdBufferFlushDraws(grCmdBuffer);
+    }
+
+    if (grCmdBuffer->multiDrawCount == 0) {
+        grCmdBufferUpdateResources(grCmdBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS);
+        grCmdBufferBeginRenderPass(grCmdBuffer);
+
+        grCmdBuffer->isMultiDrawIndexed = isIndexed;
+        grCmdBuffer->multiDrawFirstInstance = firstInstance;
+        grCmdBuffer->multiDrawInstanceCount = instanceCount;
+    }
+
+    grCmdBuffer->multiDraws[grCmdBuffer->multiDrawCount] = *drawInfo;
+    grCmdBuffer->multiDrawCount++;
+    return true;
 }
 
 // Command Buffer Building Functions
@@ -335,15 +1224,15 @@ GR_VOID GR_STDCALL grCmdBindPipeline(
     bindPoint->grPipeline = grPipeline;
 
     if (vkBindPoint == VK_PIPELINE_BIND_POINT_GRAPHICS) {
-        bindPoint->dirtyFlags |= FLAG_DIRTY_DESCRIPTOR_SETS |
-                                 FLAG_DIRTY_PIPELINE;
+        bindPoint->dirtyFlags |= FLAG_DIRTY_PIPELINE;
+        bindPoint->dirtyDescriptorSetMask = ALL_STAGES_MASK;
     } else {
         // Pipeline creation isn't deferred for compute, bind now
         VKD.vkCmdBindPipeline(grCmdBuffer->commandBuffer, vkBindPoint,
                               grPipelineFindOrCreateVkPipeline(grPipeline, NULL, NULL, NULL,
                                                                0, NULL, VK_FORMAT_UNDEFINED));
 
-        bindPoint->dirtyFlags |= FLAG_DIRTY_DESCRIPTOR_SETS;
+        bindPoint->dirtyDescriptorSetMask = ALL_STAGES_MASK;
     }
 }
 
@@ -357,111 +1246,154 @@ GR_VOID GR_STDCALL grCmdBindStateObject(
     GrDevice* grDevice = GET_OBJ_DEVICE(grCmdBuffer);
     BindPoint* bindPoint = &grCmdBuffer->bindPoints[VK_PIPELINE_BIND_POINT_GRAPHICS];
 
-    // TODO compare objects instead of just pointers
+    grCmdBufferFlushDraws(grCmdBuffer);
+
+    // Only emit the dynamic state that differs from the recorded values
+    DynamicState* dynState = &grCmdBuffer->dynamicState;
 
     switch ((GR_STATE_BIND_POINT)stateBindPoint) {
     case GR_STATE_BIND_VIEWPORT: {
         GrViewportStateObject* viewportState = (GrViewportStateObject*)state;
-        if (viewportState == grCmdBuffer->grViewportState) {
-            break;
+        bool isRecorded = dynState->validMask & DYNAMIC_STATE_VIEWPORT;
+
+        if (!isRecorded || viewportState->viewportCount != dynState->viewportCount ||
+            memcmp(viewportState->viewports, dynState->viewports,
+                   viewportState->viewportCount * sizeof(VkViewport)) != 0) {
+            VKD.vkCmdSetViewportWithCountEXT(grCmdBuffer->commandBuffer,
+                                             viewportState->viewportCount,
+                                             viewportState->viewports);
+            dynState->viewportCount = viewportState->viewportCount;
+            memcpy(dynState->viewports, viewportState->viewports,
+                   viewportState->viewportCount * sizeof(VkViewport));
+        }
+        if (!isRecorded || viewportState->scissorCount != dynState->scissorCount ||
+            memcmp(viewportState->scissors, dynState->scissors,
+                   viewportState->scissorCount * sizeof(VkRect2D)) != 0) {
+            VKD.vkCmdSetScissorWithCountEXT(grCmdBuffer->commandBuffer,
+                                            viewportState->scissorCount, viewportState->scissors);
+            dynState->scissorCount = viewportState->scissorCount;
+            memcpy(dynState->scissors, viewportState->scissors,
+                   viewportState->scissorCount * sizeof(VkRect2D));
         }
 
-        VKD.vkCmdSetViewportWithCountEXT(grCmdBuffer->commandBuffer,
-                                         viewportState->viewportCount, viewportState->viewports);
-        VKD.vkCmdSetScissorWithCountEXT(grCmdBuffer->commandBuffer, viewportState->scissorCount,
-                                        viewportState->scissors);
-
+        dynState->validMask |= DYNAMIC_STATE_VIEWPORT;
         grCmdBuffer->grViewportState = viewportState;
     }   break;
     case GR_STATE_BIND_RASTER: {
         GrRasterStateObject* rasterState = (GrRasterStateObject*)state;
-        if (rasterState == grCmdBuffer->grRasterState) {
-            break;
-        }
-
-        VKD.vkCmdSetCullModeEXT(grCmdBuffer->commandBuffer, rasterState->cullMode);
-        VKD.vkCmdSetFrontFaceEXT(grCmdBuffer->commandBuffer, rasterState->frontFace);
-        VKD.vkCmdSetDepthBias(grCmdBuffer->commandBuffer, rasterState->depthBiasConstantFactor,
-                              rasterState->depthBiasClamp, rasterState->depthBiasSlopeFactor);
+        bool isRecorded = dynState->validMask & DYNAMIC_STATE_RASTER;
 
-        if (grCmdBuffer->grRasterState == NULL ||
-            rasterState->polygonMode != grCmdBuffer->grRasterState->polygonMode) {
+        if (!isRecorded || rasterState->cullMode != dynState->cullMode) {
+            VKD.vkCmdSetCullModeEXT(grCmdBuffer->commandBuffer, rasterState->cullMode);
+            dynState->cullMode = rasterState->cullMode;
+        }
+        if (!isRecorded || rasterState->frontFace != dynState->frontFace) {
+            VKD.vkCmdSetFrontFaceEXT(grCmdBuffer->commandBuffer, rasterState->frontFace);
+            dynState->frontFace = rasterState->frontFace;
+        }
+        if (!isRecorded ||
+            rasterState->depthBiasConstantFactor != dynState->depthBiasConstantFactor ||
+            rasterState->depthBiasClamp != dynState->depthBiasClamp ||
+            rasterState->depthBiasSlopeFactor != dynState->depthBiasSlopeFactor) {
+            VKD.vkCmdSetDepthBias(grCmdBuffer->commandBuffer, rasterState->depthBiasConstantFactor,
+                                  rasterState->depthBiasClamp, rasterState->depthBiasSlopeFactor);
+            dynState->depthBiasConstantFactor = rasterState->depthBiasConstantFactor;
+            dynState->depthBiasClamp = rasterState->depthBiasClamp;
+            dynState->depthBiasSlopeFactor = rasterState->depthBiasSlopeFactor;
+        }
+        if (!isRecorded || rasterState->polygonMode != dynState->polygonMode) {
             bindPoint->dirtyFlags |= FLAG_DIRTY_PIPELINE;
+            dynState->polygonMode = rasterState->polygonMode;
         }
 
+        dynState->validMask |= DYNAMIC_STATE_RASTER;
         grCmdBuffer->grRasterState = rasterState;
     }   break;
     case GR_STATE_BIND_DEPTH_STENCIL: {
         GrDepthStencilStateObject* depthStencilState = (GrDepthStencilStateObject*)state;
-        if (depthStencilState == grCmdBuffer->grDepthStencilState) {
-            break;
+        bool isRecorded = dynState->validMask & DYNAMIC_STATE_DEPTH_STENCIL;
+
+        if (!isRecorded || depthStencilState->depthTestEnable != dynState->depthTestEnable) {
+            VKD.vkCmdSetDepthTestEnableEXT(grCmdBuffer->commandBuffer,
+                                           depthStencilState->depthTestEnable);
+            dynState->depthTestEnable = depthStencilState->depthTestEnable;
+        }
+        if (!isRecorded || depthStencilState->depthWriteEnable != dynState->depthWriteEnable) {
+            VKD.vkCmdSetDepthWriteEnableEXT(grCmdBuffer->commandBuffer,
+                                            depthStencilState->depthWriteEnable);
+            dynState->depthWriteEnable = depthStencilState->depthWriteEnable;
+        }
+        if (!isRecorded || depthStencilState->depthCompareOp != dynState->depthCompareOp) {
+            VKD.vkCmdSetDepthCompareOpEXT(grCmdBuffer->commandBuffer,
+                                          depthStencilState->depthCompareOp);
+            dynState->depthCompareOp = depthStencilState->depthCompareOp;
+        }
+        if (!isRecorded ||
+            depthStencilState->depthBoundsTestEnable != dynState->depthBoundsTestEnable) {
+            VKD.vkCmdSetDepthBoundsTestEnableEXT(grCmdBuffer->commandBuffer,
+                                                 depthStencilState->depthBoundsTestEnable);
+            dynState->depthBoundsTestEnable = depthStencilState->depthBoundsTestEnable;
+        }
+        if (!isRecorded || depthStencilState->stencilTestEnable != dynState->stencilTestEnable) {
+            VKD.vkCmdSetStencilTestEnableEXT(grCmdBuffer->commandBuffer,
+                                             depthStencilState->stencilTestEnable);
+            dynState->stencilTestEnable = depthStencilState->stencilTestEnable;
         }
 
-        VKD.vkCmdSetDepthTestEnableEXT(grCmdBuffer->commandBuffer,
-                                       depthStencilState->depthTestEnable);
-        VKD.vkCmdSetDepthWriteEnableEXT(grCmdBuffer->commandBuffer,
-                                        depthStencilState->depthWriteEnable);
-        VKD.vkCmdSetDepthCompareOpEXT(grCmdBuffer->commandBuffer,
-                                      depthStencilState->depthCompareOp);
-        VKD.vkCmdSetDepthBoundsTestEnableEXT(grCmdBuffer->commandBuffer,
-                                             depthStencilState->depthBoundsTestEnable);
-        VKD.vkCmdSetStencilTestEnableEXT(grCmdBuffer->commandBuffer,
-                                         depthStencilState->stencilTestEnable);
-        VKD.vkCmdSetStencilOpEXT(grCmdBuffer->commandBuffer, VK_STENCIL_FACE_FRONT_BIT,
-                                 depthStencilState->front.failOp,
-                                 depthStencilState->front.passOp,
-                                 depthStencilState->front.depthFailOp,
-                                 depthStencilState->front.compareOp);
-        VKD.vkCmdSetStencilCompareMask(grCmdBuffer->commandBuffer, VK_STENCIL_FACE_FRONT_BIT,
-                                       depthStencilState->front.compareMask);
-        VKD.vkCmdSetStencilWriteMask(grCmdBuffer->commandBuffer, VK_STENCIL_FACE_FRONT_BIT,
-                                     depthStencilState->front.writeMask);
-        VKD.vkCmdSetStencilReference(grCmdBuffer->commandBuffer, VK_STENCIL_FACE_FRONT_BIT,
-                                     depthStencilState->front.reference);
-        VKD.vkCmdSetStencilOpEXT(grCmdBuffer->commandBuffer, VK_STENCIL_FACE_BACK_BIT,
-                                 depthStencilState->back.failOp,
-                                 depthStencilState->back.passOp,
-                                 depthStencilState->back.depthFailOp,
-                                 depthStencilState->back.compareOp);
-        VKD.vkCmdSetStencilCompareMask(grCmdBuffer->commandBuffer, VK_STENCIL_FACE_BACK_BIT,
-                                       depthStencilState->back.compareMask);
-        VKD.vkCmdSetStencilWriteMask(grCmdBuffer->commandBuffer, VK_STENCIL_FACE_BACK_BIT,
-                                     depthStencilState->back.writeMask);
-        VKD.vkCmdSetStencilReference(grCmdBuffer->commandBuffer, VK_STENCIL_FACE_BACK_BIT,
-                                     depthStencilState->back.reference);
-        VKD.vkCmdSetDepthBounds(grCmdBuffer->commandBuffer, depthStencilState->minDepthBounds,
-                                                            depthStencilState->maxDepthBounds);
+        setStencilFaceState(grCmdBuffer, VK_STENCIL_FACE_FRONT_BIT, &dynState->front,
+                            &depthStencilState->front, isRecorded);
+        setStencilFaceState(grCmdBuffer, VK_STENCIL_FACE_BACK_BIT, &dynState->back,
+                            &depthStencilState->back, isRecorded);
+
+        if (!isRecorded ||
+            depthStencilState->minDepthBounds != dynState->minDepthBounds ||
+            depthStencilState->maxDepthBounds != dynState->maxDepthBounds) {
+            VKD.vkCmdSetDepthBounds(grCmdBuffer->commandBuffer,
+                                    depthStencilState->minDepthBounds,
+                                    depthStencilState->maxDepthBounds);
+            dynState->minDepthBounds = depthStencilState->minDepthBounds;
+            dynState->maxDepthBounds = depthStencilState->maxDepthBounds;
+        }
 
+        dynState->validMask |= DYNAMIC_STATE_DEPTH_STENCIL;
         grCmdBuffer->grDepthStencilState = depthStencilState;
     }   break;
     case GR_STATE_BIND_COLOR_BLEND: {
         GrColorBlendStateObject* colorBlendState = (GrColorBlendStateObject*)state;
-        if (colorBlendState == grCmdBuffer->grColorBlendState) {
-            break;
+        bool isRecorded = dynState->validMask & DYNAMIC_STATE_COLOR_BLEND;
+
+        if (!isRecorded ||
+            memcmp(colorBlendState->blendConstants, dynState->blendConstants,
+                   sizeof(dynState->blendConstants)) != 0) {
+            VKD.vkCmdSetBlendConstants(grCmdBuffer->commandBuffer,
+                                       colorBlendState->blendConstants);
+            memcpy(dynState->blendConstants, colorBlendState->blendConstants,
+                   sizeof(dynState->blendConstants));
         }
-
-        VKD.vkCmdSetBlendConstants(grCmdBuffer->commandBuffer, colorBlendState->blendConstants);
-
-        if (grCmdBuffer->grColorBlendState == NULL ||
-            memcmp(colorBlendState->states, grCmdBuffer->grColorBlendState->states,
-                   sizeof(colorBlendState->states)) != 0) {
+        if (!isRecorded ||
+            memcmp(colorBlendState->states, dynState->blendStates,
+                   sizeof(dynState->blendStates)) != 0) {
             bindPoint->dirtyFlags |= FLAG_DIRTY_PIPELINE;
+            memcpy(dynState->blendStates, colorBlendState->states,
+                   sizeof(dynState->blendStates));
         }
 
+        dynState->validMask |= DYNAMIC_STATE_COLOR_BLEND;
         grCmdBuffer->grColorBlendState = colorBlendState;
     }   break;
     case GR_STATE_BIND_MSAA: {
         GrMsaaStateObject* msaaState = (GrMsaaStateObject*)state;
-        if (msaaState == grCmdBuffer->grMsaaState) {
-            break;
-        }
+        bool isRecorded = dynState->validMask & DYNAMIC_STATE_MSAA;
 
-        if (grCmdBuffer->grMsaaState == NULL ||
-            msaaState->sampleCountFlags != grCmdBuffer->grMsaaState->sampleCountFlags ||
-            msaaState->sampleMask != grCmdBuffer->grMsaaState->sampleMask) {
+        if (!isRecorded ||
+            msaaState->sampleCountFlags != dynState->sampleCountFlags ||
+            msaaState->sampleMask != dynState->sampleMask) {
             bindPoint->dirtyFlags |= FLAG_DIRTY_PIPELINE;
+            dynState->sampleCountFlags = msaaState->sampleCountFlags;
+            dynState->sampleMask = msaaState->sampleMask;
         }
 
+        dynState->validMask |= DYNAMIC_STATE_MSAA;
         grCmdBuffer->grMsaaState = msaaState;
     }   break;
     }
@@ -490,7 +1422,9 @@ GR_VOID GR_STDCALL grCmdBindDescriptorSet(
 
     bindPoint->grDescriptorSet = grDescriptorSet;
     bindPoint->slotOffset = slotOffset;
-    bindPoint->dirtyFlags |= FLAG_DIRTY_DESCRIPTOR_SETS;
+    bindPoint->dirtyDescriptorSetMask |= bindPoint->grPipeline != NULL ?
+                                         bindPoint->grPipeline->descriptorSetStageMask :
+                                         ALL_STAGES_MASK;
 }
 
 GR_VOID GR_STDCALL grCmdBindDynamicMemoryView(
@@ -512,23 +1446,17 @@ GR_VOID GR_STDCALL grCmdBindDynamicMemoryView(
         bindPoint->dirtyFlags |= FLAG_DIRTY_DYNAMIC_OFFSET;
     }
 
-    if (grGpuMemory->buffer != bindPoint->dynamicMemoryView.buffer.bufferInfo.buffer ||
-        pMemView->range != bindPoint->dynamicMemoryView.buffer.bufferInfo.range ||
-        pMemView->stride != bindPoint->dynamicMemoryView.buffer.stride) {
-        bindPoint->dynamicMemoryView = (DescriptorSetSlot) {
-            .type = SLOT_TYPE_BUFFER,
-            .buffer = {
-                .bufferView = VK_NULL_HANDLE,
-                .bufferInfo = {
-                    .buffer = grGpuMemory->buffer,
-                    .offset = 0,
-                    .range = pMemView->range,
-                },
-                .stride = pMemView->stride,
-            },
-        };
+    const DescriptorSetSlot* dynamicMemoryView = &bindPoint->dynamicMemoryView;
+
+    if (grGpuMemory->buffer != dynamicMemoryView->descriptor.info.buffer.buffer ||
+        pMemView->range != dynamicMemoryView->descriptor.info.buffer.range ||
+        pMemView->stride != dynamicMemoryView->descriptor.stride) {
+        setDescriptorSetSlotBuffer(&bindPoint->dynamicMemoryView, grGpuMemory->buffer, 0,
+                                   pMemView->range, VK_NULL_HANDLE, pMemView->stride);
 
-        bindPoint->dirtyFlags |= FLAG_DIRTY_DESCRIPTOR_SETS;
+        bindPoint->dirtyDescriptorSetMask |= bindPoint->grPipeline != NULL ?
+                                             bindPoint->grPipeline->dynamicMemoryViewStageMask :
+                                             ALL_STAGES_MASK;
     }
 }
 
@@ -539,10 +1467,12 @@ GR_VOID GR_STDCALL grCmdBindIndexData(
     GR_ENUM indexType)
 {
     LOGT("%p %p %u 0x%X\n", cmdBuffer, mem, offset, indexType);
-    const GrCmdBuffer* grCmdBuffer = (GrCmdBuffer*)cmdBuffer;
+    GrCmdBuffer* grCmdBuffer = (GrCmdBuffer*)cmdBuffer;
     const GrDevice* grDevice = GET_OBJ_DEVICE(grCmdBuffer);
     GrGpuMemory* grGpuMemory = (GrGpuMemory*)mem;
 
+    grCmdBufferFlushDraws(grCmdBuffer);
+
     VKD.vkCmdBindIndexBuffer(grCmdBuffer->commandBuffer, grGpuMemory->buffer, offset,
                              getVkIndexType(indexType));
 }
@@ -554,38 +1484,52 @@ GR_VOID GR_STDCALL grCmdPrepareMemoryRegions(
 {
     LOGT("%p %u %p\n", cmdBuffer, transitionCount, pStateTransitions);
     GrCmdBuffer* grCmdBuffer = (GrCmdBuffer*)cmdBuffer;
-    const GrDevice* grDevice = GET_OBJ_DEVICE(grCmdBuffer);
 
-    grCmdBufferEndRenderPass(grCmdBuffer);
+    for (unsigned i = 0; i < transitionCount && grCmdBuffer->pendingTimestampCount > 0; i++) {
+        const GrGpuMemory* grGpuMemory = (GrGpuMemory*)pStateTransitions[i].mem;
 
-    STACK_ARRAY(VkBufferMemoryBarrier, barriers, 128, transitionCount);
-    VkPipelineStageFlags srcStageMask = 0;
-    VkPipelineStageFlags dstStageMask = 0;
+        resolveMemoryTimestamps(grCmdBuffer, grGpuMemory->buffer);
+    }
+
+    // Batched with other transitions until a command depends on them
+    grCmdBuffer->bufferBarriers = realloc(grCmdBuffer->bufferBarriers,
+                                          (grCmdBuffer->bufferBarrierCount + transitionCount) *
+                                          sizeof(VkBufferMemoryBarrier2KHR));
+    VkBufferMemoryBarrier2KHR* barriers =
+        &grCmdBuffer->bufferBarriers[grCmdBuffer->bufferBarrierCount];
+    unsigned barrierCount = 0;
 
     for (unsigned i = 0; i < transitionCount; i++) {
         const GR_MEMORY_STATE_TRANSITION* stateTransition = &pStateTransitions[i];
         GrGpuMemory* grGpuMemory = (GrGpuMemory*)stateTransition->mem;
+        VkDeviceSize size = stateTransition->regionSize > 0 ? stateTransition->regionSize
+                                                            : VK_WHOLE_SIZE;
+        GR_MEMORY_STATE trackedState = 0;
+
+        bool isTracked = trackMemoryState(&trackedState, grCmdBuffer, grGpuMemory->buffer,
+                                          stateTransition->offset, size,
+                                          stateTransition->newState);
+        if (isMemoryTransitionRedundant(stateTransition->oldState, stateTransition->newState,
+                                        isTracked, trackedState)) {
+            continue;
+        }
 
-        barriers[i] = (VkBufferMemoryBarrier) {
-            .sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
+        barriers[barrierCount++] = (VkBufferMemoryBarrier2KHR) {
+            .sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER_2_KHR,
             .pNext = NULL,
+            .srcStageMask = getVkPipelineStageFlagsMemory(stateTransition->oldState),
             .srcAccessMask = getVkAccessFlagsMemory(stateTransition->oldState),
+            .dstStageMask = getVkPipelineStageFlagsMemory(stateTransition->newState),
             .dstAccessMask = getVkAccessFlagsMemory(stateTransition->newState),
             .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
             .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
             .buffer = grGpuMemory->buffer,
             .offset = stateTransition->offset,
-            .size = stateTransition->regionSize > 0 ? stateTransition->regionSize : VK_WHOLE_SIZE,
+            .size = size,
         };
-
-        srcStageMask |= getVkPipelineStageFlagsMemory(stateTransition->oldState);
-        dstStageMask |= getVkPipelineStageFlagsMemory(stateTransition->newState);
     }
 
-    VKD.vkCmdPipelineBarrier(grCmdBuffer->commandBuffer, srcStageMask, dstStageMask,
-                             0, 0, NULL, transitionCount, barriers, 0, NULL);
-
-    STACK_ARRAY_FINISH(barriers);
+    grCmdBuffer->bufferBarrierCount += barrierCount;
 }
 
 GR_VOID GR_STDCALL grCmdBindTargets(
@@ -599,11 +1543,13 @@ GR_VOID GR_STDCALL grCmdBindTargets(
     BindPoint* bindPoint = &grCmdBuffer->bindPoints[VK_PIPELINE_BIND_POINT_GRAPHICS];
 
     unsigned colorAttachmentCount = 0;
+    const GrColorTargetView* grColorTargetViews[GR_MAX_COLOR_TARGETS];
     VkRenderingAttachmentInfoKHR colorAttachments[GR_MAX_COLOR_TARGETS];
     VkFormat colorFormats[GR_MAX_COLOR_TARGETS];
     bool hasDepthStencil = false;
     VkRenderingAttachmentInfoKHR depthAttachment;
     VkRenderingAttachmentInfoKHR stencilAttachment;
+    const GrDepthStencilView* grDepthStencilView = NULL;
     VkFormat depthStencilFormat = VK_FORMAT_UNDEFINED;
     VkExtent3D minExtent = { UINT32_MAX, UINT32_MAX, UINT32_MAX };
 
@@ -623,6 +1569,7 @@ GR_VOID GR_STDCALL grCmdBindTargets(
                 .storeOp = VK_ATTACHMENT_STORE_OP_STORE,
                 .clearValue = {{{ 0 }}},
             };
+            grColorTargetViews[colorAttachmentCount] = grColorTargetView;
             colorFormats[colorAttachmentCount] = grColorTargetView->format;
             colorAttachmentCount++;
 
@@ -633,7 +1580,7 @@ GR_VOID GR_STDCALL grCmdBindTargets(
     }
 
     if (pDepthTarget != NULL && pDepthTarget->view != NULL) {
-        const GrDepthStencilView* grDepthStencilView = (GrDepthStencilView*)pDepthTarget->view;
+        grDepthStencilView = (GrDepthStencilView*)pDepthTarget->view;
 
         hasDepthStencil = true;
         depthAttachment = (VkRenderingAttachmentInfoKHR) {
@@ -674,6 +1621,9 @@ GR_VOID GR_STDCALL grCmdBindTargets(
         (hasDepthStencil && memcmp(&stencilAttachment, &grCmdBuffer->stencilAttachment, sizeof(stencilAttachment))) ||
         memcmp(&minExtent, &grCmdBuffer->minExtent, sizeof(minExtent))) {
         // Targets have changed
+        memcpy(grCmdBuffer->grColorTargetViews, grColorTargetViews,
+               colorAttachmentCount * sizeof(grColorTargetViews[0]));
+        grCmdBuffer->grDepthStencilView = grDepthStencilView;
         grCmdBuffer->colorAttachmentCount = colorAttachmentCount;
         memcpy(grCmdBuffer->colorAttachments, colorAttachments, colorAttachmentCount * sizeof(colorAttachments[0]));
         grCmdBuffer->hasDepthStencil = hasDepthStencil;
@@ -705,41 +1655,48 @@ GR_VOID GR_STDCALL grCmdPrepareImages(
 {
     LOGT("%p %u %p\n", cmdBuffer, transitionCount, pStateTransitions);
     GrCmdBuffer* grCmdBuffer = (GrCmdBuffer*)cmdBuffer;
-    const GrDevice* grDevice = GET_OBJ_DEVICE(grCmdBuffer);
 
-    grCmdBufferEndRenderPass(grCmdBuffer);
-
-    STACK_ARRAY(VkImageMemoryBarrier, barriers, 128, transitionCount);
-    VkPipelineStageFlags srcStageMask = 0;
-    VkPipelineStageFlags dstStageMask = 0;
+    // Batched with other transitions until a command depends on them
+    grCmdBuffer->imageBarriers = realloc(grCmdBuffer->imageBarriers,
+                                         (grCmdBuffer->imageBarrierCount + transitionCount) *
+                                         sizeof(VkImageMemoryBarrier2KHR));
+    VkImageMemoryBarrier2KHR* barriers =
+        &grCmdBuffer->imageBarriers[grCmdBuffer->imageBarrierCount];
+    unsigned barrierCount = 0;
 
     for (unsigned i = 0; i < transitionCount; i++) {
         const GR_IMAGE_STATE_TRANSITION* stateTransition = &pStateTransitions[i];
         GrImage* grImage = (GrImage*)stateTransition->image;
         bool isDepthStencil = isVkFormatDepthStencil(grImage->format);
+        VkImageSubresourceRange subresourceRange =
+            getVkImageSubresourceRange(stateTransition->subresourceRange,
+                                       grImage->multiplyCubeLayers);
+        GR_IMAGE_STATE trackedState = 0;
+
+        bool isTracked = trackImageState(&trackedState, grCmdBuffer, grImage->image,
+                                         &subresourceRange, stateTransition->newState);
+        if (isImageTransitionRedundant(stateTransition->oldState, stateTransition->newState,
+                                       isDepthStencil, isTracked, trackedState)) {
+            continue;
+        }
 
-        barriers[i] = (VkImageMemoryBarrier) {
-            .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+        barriers[barrierCount++] = (VkImageMemoryBarrier2KHR) {
+            .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2_KHR,
             .pNext = NULL,
+            .srcStageMask = getVkPipelineStageFlagsImage(stateTransition->oldState),
             .srcAccessMask = getVkAccessFlagsImage(stateTransition->oldState, isDepthStencil),
+            .dstStageMask = getVkPipelineStageFlagsImage(stateTransition->newState),
             .dstAccessMask = getVkAccessFlagsImage(stateTransition->newState, isDepthStencil),
             .oldLayout = getVkImageLayout(stateTransition->oldState, isDepthStencil),
             .newLayout = getVkImageLayout(stateTransition->newState, isDepthStencil),
             .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
             .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
             .image = grImage->image,
-            .subresourceRange = getVkImageSubresourceRange(stateTransition->subresourceRange,
-                                                           grImage->multiplyCubeLayers),
+            .subresourceRange = subresourceRange,
         };
-
-        srcStageMask |= getVkPipelineStageFlagsImage(stateTransition->oldState);
-        dstStageMask |= getVkPipelineStageFlagsImage(stateTransition->newState);
     }
 
-    VKD.vkCmdPipelineBarrier(grCmdBuffer->commandBuffer, srcStageMask, dstStageMask,
-                             0, 0, NULL, 0, NULL, transitionCount, barriers);
-
-    STACK_ARRAY_FINISH(barriers);
+    grCmdBuffer->imageBarrierCount += barrierCount;
 }
 
 GR_VOID GR_STDCALL grCmdDraw(
@@ -753,6 +1710,17 @@ GR_VOID GR_STDCALL grCmdDraw(
     GrCmdBuffer* grCmdBuffer = (GrCmdBuffer*)cmdBuffer;
     const GrDevice* grDevice = GET_OBJ_DEVICE(grCmdBuffer);
 
+    const MultiDrawInfo drawInfo = {
+        .draw = {
+            .firstVertex = firstVertex,
+            .vertexCount = vertexCount,
+        },
+    };
+
+    if (grCmdBufferQueueDraw(grCmdBuffer, false, firstInstance, instanceCount, &drawInfo)) {
+        return;
+    }
+
     grCmdBufferUpdateResources(grCmdBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS);
     grCmdBufferBeginRenderPass(grCmdBuffer);
 
@@ -773,6 +1741,18 @@ GR_VOID GR_STDCALL grCmdDrawIndexed(
     GrCmdBuffer* grCmdBuffer = (GrCmdBuffer*)cmdBuffer;
     const GrDevice* grDevice = GET_OBJ_DEVICE(grCmdBuffer);
 
+    const MultiDrawInfo drawInfo = {
+        .indexedDraw = {
+            .firstIndex = firstIndex,
+            .indexCount = indexCount,
+            .vertexOffset = vertexOffset,
+        },
+    };
+
+    if (grCmdBufferQueueDraw(grCmdBuffer, true, firstInstance, instanceCount, &drawInfo)) {
+        return;
+    }
+
     grCmdBufferUpdateResources(grCmdBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS);
     grCmdBufferBeginRenderPass(grCmdBuffer);
 
@@ -857,7 +1837,12 @@ GR_VOID GR_STDCALL grCmdCopyMemory(
     GrGpuMemory* grSrcGpuMemory = (GrGpuMemory*)srcMem;
     GrGpuMemory* grDstGpuMemory = (GrGpuMemory*)destMem;
 
+    resolveMemoryTimestamps(grCmdBuffer, grSrcGpuMemory->buffer);
+    resolveMemoryTimestamps(grCmdBuffer, grDstGpuMemory->buffer);
+    markMemoryReferenced(grCmdBuffer, grSrcGpuMemory->buffer);
+    markMemoryReferenced(grCmdBuffer, grDstGpuMemory->buffer);
     grCmdBufferEndRenderPass(grCmdBuffer);
+    grCmdBufferFlushBarriers(grCmdBuffer);
 
     STACK_ARRAY(VkBufferCopy, vkRegions, 128, regionCount);
 
@@ -900,6 +1885,7 @@ GR_VOID GR_STDCALL grCmdCopyImage(
     }
 
     grCmdBufferEndRenderPass(grCmdBuffer);
+    grCmdBufferFlushBarriers(grCmdBuffer);
 
     if (grSrcImage->image != VK_NULL_HANDLE) {
         STACK_ARRAY(VkImageCopy, vkRegions, 128, regionCount);
@@ -1002,7 +1988,10 @@ GR_VOID GR_STDCALL grCmdCopyMemoryToImage(
         dstTileSize = 1;
     }
 
+    resolveMemoryTimestamps(grCmdBuffer, grSrcGpuMemory->buffer);
+    markMemoryReferenced(grCmdBuffer, grSrcGpuMemory->buffer);
     grCmdBufferEndRenderPass(grCmdBuffer);
+    grCmdBufferFlushBarriers(grCmdBuffer);
 
     STACK_ARRAY(VkBufferImageCopy, vkRegions, 128, regionCount);
 
@@ -1055,7 +2044,10 @@ GR_VOID GR_STDCALL grCmdCopyImageToMemory(
         srcTileSize = 1;
     }
 
+    resolveMemoryTimestamps(grCmdBuffer, grDstGpuMemory->buffer);
+    markMemoryReferenced(grCmdBuffer, grDstGpuMemory->buffer);
     grCmdBufferEndRenderPass(grCmdBuffer);
+    grCmdBufferFlushBarriers(grCmdBuffer);
 
     STACK_ARRAY(VkBufferImageCopy, vkRegions, 128, regionCount);
 
@@ -1101,9 +2093,11 @@ GR_VOID GR_STDCALL grCmdUpdateMemory(
     const GrDevice* grDevice = GET_OBJ_DEVICE(grCmdBuffer);
     GrGpuMemory* grDstGpuMemory = (GrGpuMemory*)destMem;
 
-    grCmdBufferEndRenderPass(grCmdBuffer);
+    resolveMemoryTimestamps(grCmdBuffer, grDstGpuMemory->buffer);
+    VkCommandBuffer vkCommandBuffer = getMemoryWriteCommandBuffer(grCmdBuffer,
+                                                                  grDstGpuMemory->buffer);
 
-    VKD.vkCmdUpdateBuffer(grCmdBuffer->commandBuffer, grDstGpuMemory->buffer, destOffset,
+    VKD.vkCmdUpdateBuffer(vkCommandBuffer, grDstGpuMemory->buffer, destOffset,
                           dataSize, pData);
 }
 
@@ -1119,9 +2113,11 @@ GR_VOID GR_STDCALL grCmdFillMemory(
     const GrDevice* grDevice = GET_OBJ_DEVICE(grCmdBuffer);
     GrGpuMemory* grDstGpuMemory = (GrGpuMemory*)destMem;
 
-    grCmdBufferEndRenderPass(grCmdBuffer);
+    resolveMemoryTimestamps(grCmdBuffer, grDstGpuMemory->buffer);
+    VkCommandBuffer vkCommandBuffer = getMemoryWriteCommandBuffer(grCmdBuffer,
+                                                                  grDstGpuMemory->buffer);
 
-    VKD.vkCmdFillBuffer(grCmdBuffer->commandBuffer, grDstGpuMemory->buffer, destOffset,
+    VKD.vkCmdFillBuffer(vkCommandBuffer, grDstGpuMemory->buffer, destOffset,
                         fillSize, data);
 }
 
@@ -1139,11 +2135,22 @@ GR_VOID GR_STDCALL grCmdClearColorImage(
     GrImage* grImage = (GrImage*)image;
 
     grCmdBufferEndRenderPass(grCmdBuffer);
+    grCmdBufferFlushBarriers(grCmdBuffer);
 
     const VkClearColorValue vkColor = {
         .float32 = { color[0], color[1], color[2], color[3] },
     };
 
+    if (rangeCount == 1 && (grImage->usage & VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT)) {
+        // Deferred in case the image gets bound as a target next
+        const VkImageSubresourceRange vkRange =
+            getVkImageSubresourceRange(pRanges[0], grImage->multiplyCubeLayers);
+
+        queuePendingClear(grCmdBuffer, grImage->image, &vkRange,
+                          &(VkClearValue) { .color = vkColor });
+        return;
+    }
+
     STACK_ARRAY(VkImageSubresourceRange, vkRanges, 128, rangeCount);
 
     for (unsigned i = 0; i < rangeCount; i++) {
@@ -1171,11 +2178,21 @@ GR_VOID GR_STDCALL grCmdClearColorImageRaw(
     GrImage* grImage = (GrImage*)image;
 
     grCmdBufferEndRenderPass(grCmdBuffer);
+    grCmdBufferFlushBarriers(grCmdBuffer);
 
     const VkClearColorValue vkColor = {
         .uint32 = { color[0], color[1], color[2], color[3] },
     };
 
+    if (rangeCount == 1 && (grImage->usage & VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT)) {
+        const VkImageSubresourceRange vkRange =
+            getVkImageSubresourceRange(pRanges[0], grImage->multiplyCubeLayers);
+
+        queuePendingClear(grCmdBuffer, grImage->image, &vkRange,
+                          &(VkClearValue) { .color = vkColor });
+        return;
+    }
+
     STACK_ARRAY(VkImageSubresourceRange, vkRanges, 128, rangeCount);
 
     for (unsigned i = 0; i < rangeCount; i++) {
@@ -1203,12 +2220,22 @@ GR_VOID GR_STDCALL grCmdClearDepthStencil(
     GrImage* grImage = (GrImage*)image;
 
     grCmdBufferEndRenderPass(grCmdBuffer);
+    grCmdBufferFlushBarriers(grCmdBuffer);
 
     const VkClearDepthStencilValue depthStencilValue = {
         .depth = depth,
         .stencil = stencil,
     };
 
+    if (rangeCount == 1 && (grImage->usage & VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT)) {
+        const VkImageSubresourceRange vkRange =
+            getVkImageSubresourceRange(pRanges[0], grImage->multiplyCubeLayers);
+
+        queuePendingClear(grCmdBuffer, grImage->image, &vkRange,
+                          &(VkClearValue) { .depthStencil = depthStencilValue });
+        return;
+    }
+
     STACK_ARRAY(VkImageSubresourceRange, vkRanges, 128, rangeCount);
 
     for (unsigned i = 0; i < rangeCount; i++) {
@@ -1232,6 +2259,7 @@ GR_VOID GR_STDCALL grCmdSetEvent(
     GrEvent* grEvent = (GrEvent*)event;
 
     grCmdBufferEndRenderPass(grCmdBuffer);
+    grCmdBufferFlushBarriers(grCmdBuffer);
 
     VKD.vkCmdSetEvent(grCmdBuffer->commandBuffer, grEvent->event,
                       VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT);
@@ -1247,6 +2275,7 @@ GR_VOID GR_STDCALL grCmdResetEvent(
     GrEvent* grEvent = (GrEvent*)event;
 
     grCmdBufferEndRenderPass(grCmdBuffer);
+    grCmdBufferFlushBarriers(grCmdBuffer);
 
     VKD.vkCmdResetEvent(grCmdBuffer->commandBuffer, grEvent->event,
                         VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT);
@@ -1259,10 +2288,12 @@ GR_VOID GR_STDCALL grCmdBeginQuery(
     GR_FLAGS flags)
 {
     LOGT("%p %p %u 0x%X\n", cmdBuffer, queryPool, slot, flags);
-    const GrCmdBuffer* grCmdBuffer = (GrCmdBuffer*)cmdBuffer;
+    GrCmdBuffer* grCmdBuffer = (GrCmdBuffer*)cmdBuffer;
     const GrDevice* grDevice = GET_OBJ_DEVICE(grCmdBuffer);
     const GrQueryPool* grQueryPool = (GrQueryPool*)queryPool;
 
+    grCmdBufferFlushDraws(grCmdBuffer);
+
     VKD.vkCmdBeginQuery(grCmdBuffer->commandBuffer, grQueryPool->queryPool, slot,
                         flags & GR_QUERY_IMPRECISE_DATA ? 0 : VK_QUERY_CONTROL_PRECISE_BIT);
 }
@@ -1273,10 +2304,12 @@ GR_VOID GR_STDCALL grCmdEndQuery(
     GR_UINT slot)
 {
     LOGT("%p %p %u\n", cmdBuffer, queryPool, slot);
-    const GrCmdBuffer* grCmdBuffer = (GrCmdBuffer*)cmdBuffer;
+    GrCmdBuffer* grCmdBuffer = (GrCmdBuffer*)cmdBuffer;
     const GrDevice* grDevice = GET_OBJ_DEVICE(grCmdBuffer);
     const GrQueryPool* grQueryPool = (GrQueryPool*)queryPool;
 
+    grCmdBufferFlushDraws(grCmdBuffer);
+
     VKD.vkCmdEndQuery(grCmdBuffer->commandBuffer, grQueryPool->queryPool, slot);
 }
 
@@ -1292,6 +2325,7 @@ GR_VOID GR_STDCALL grCmdResetQueryPool(
     const GrQueryPool* grQueryPool = (GrQueryPool*)queryPool;
 
     grCmdBufferEndRenderPass(grCmdBuffer);
+    grCmdBufferFlushBarriers(grCmdBuffer);
 
     VKD.vkCmdResetQueryPool(grCmdBuffer->commandBuffer, grQueryPool->queryPool,
                             startQuery, queryCount);
@@ -1318,16 +2352,28 @@ GR_VOID GR_STDCALL grCmdWriteTimestamp(
         assert(false);
     }
 
-    VKD.vkCmdWriteTimestamp(grCmdBuffer->commandBuffer, stageFlags,
-                            grCmdBuffer->timestampQueryPool, 0);
+    grCmdBufferFlushDraws(grCmdBuffer);
 
-    grCmdBufferEndRenderPass(grCmdBuffer);
+    if (grCmdBuffer->timestampResetCount == TIMESTAMP_QUERY_COUNT) {
+        // Out of slots, recycle them early
+        grCmdBufferResolveTimestamps(grCmdBuffer);
+        grCmdBufferEndRenderPass(grCmdBuffer);
 
-    VKD.vkCmdCopyQueryPoolResults(grCmdBuffer->commandBuffer, grCmdBuffer->timestampQueryPool,
-                                  0, 1, grGpuMemory->buffer, destOffset, sizeof(uint64_t),
-                                  VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT);
+        VKD.vkCmdResetQueryPool(grCmdBuffer->commandBuffer, grCmdBuffer->timestampQueryPool,
+                                0, TIMESTAMP_QUERY_COUNT);
+        grCmdBuffer->timestampResetCount = 0;
+    }
 
-    VKD.vkCmdResetQueryPool(grCmdBuffer->commandBuffer, grCmdBuffer->timestampQueryPool, 0, 1);
+    VKD.vkCmdWriteTimestamp(grCmdBuffer->commandBuffer, stageFlags,
+                            grCmdBuffer->timestampQueryPool, grCmdBuffer->timestampResetCount);
+
+    markMemoryReferenced(grCmdBuffer, grGpuMemory->buffer);
+    grCmdBuffer->timestampResetCount++;
+    grCmdBuffer->pendingTimestamps[grCmdBuffer->pendingTimestampCount] = (PendingTimestamp) {
+        .buffer = grGpuMemory->buffer,
+        .offset = destOffset,
+    };
+    grCmdBuffer->pendingTimestampCount++;
 }
 
 GR_VOID GR_STDCALL grCmdInitAtomicCounters(
@@ -1340,9 +2386,10 @@ GR_VOID GR_STDCALL grCmdInitAtomicCounters(
     LOGT("%p 0x%X %u %u %p\n", cmdBuffer, pipelineBindPoint, startCounter, counterCount, pData);
     GrCmdBuffer* grCmdBuffer = (GrCmdBuffer*)cmdBuffer;
     const GrDevice* grDevice = GET_OBJ_DEVICE(grCmdBuffer);
-    VkBuffer atomicCounterBuffer = grCmdBuffer->atomicCounterSlot.buffer.bufferInfo.buffer;
+    VkBuffer atomicCounterBuffer = grCmdBuffer->atomicCounterSlot.descriptor.info.buffer.buffer;
 
     grCmdBufferEndRenderPass(grCmdBuffer);
+    grCmdBufferFlushBarriers(grCmdBuffer);
 
     VkDeviceSize offset = startCounter * sizeof(uint32_t);
     VkDeviceSize size = counterCount * sizeof(uint32_t);
@@ -1405,9 +2452,12 @@ GR_VOID GR_STDCALL grCmdSaveAtomicCounters(
     GrCmdBuffer* grCmdBuffer = (GrCmdBuffer*)cmdBuffer;
     const GrDevice* grDevice = GET_OBJ_DEVICE(grCmdBuffer);
     GrGpuMemory* grDstGpuMemory = (GrGpuMemory*)destMem;
-    VkBuffer atomicCounterBuffer = grCmdBuffer->atomicCounterSlot.buffer.bufferInfo.buffer;
+    VkBuffer atomicCounterBuffer = grCmdBuffer->atomicCounterSlot.descriptor.info.buffer.buffer;
 
+    resolveMemoryTimestamps(grCmdBuffer, grDstGpuMemory->buffer);
+    markMemoryReferenced(grCmdBuffer, grDstGpuMemory->buffer);
     grCmdBufferEndRenderPass(grCmdBuffer);
+    grCmdBufferFlushBarriers(grCmdBuffer);
 
     const VkBufferCopy bufferCopy = {
         .srcOffset = startCounter * sizeof(uint32_t),
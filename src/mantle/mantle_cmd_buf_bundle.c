@@ -0,0 +1,145 @@
+#include "mantle_internal.h"
+
+#define MAX_IDLE_BUNDLE_COUNT   (256)
+
+static VkResult createCmdBufferBundle(
+    CmdBufferBundle* bundle,
+    const GrDevice* grDevice,
+    uint32_t queueFamilyIndex)
+{
+    VkResult res;
+
+    *bundle = (CmdBufferBundle) {
+        .queueFamilyIndex = queueFamilyIndex,
+        .commandPool = VK_NULL_HANDLE,
+        .commandBuffers = { VK_NULL_HANDLE, VK_NULL_HANDLE },
+        .timestampQueryPool = VK_NULL_HANDLE,
+    };
+
+    const VkCommandPoolCreateInfo poolCreateInfo = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+        .pNext = NULL,
+        .flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT,
+        .queueFamilyIndex = queueFamilyIndex,
+    };
+
+    res = VKD.vkCreateCommandPool(grDevice->device, &poolCreateInfo, NULL, &bundle->commandPool);
+    if (res != VK_SUCCESS) {
+        LOGE("vkCreateCommandPool failed (%d)\n", res);
+        return res;
+    }
+
+    const VkCommandBufferAllocateInfo allocateInfo = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+        .pNext = NULL,
+        .commandPool = bundle->commandPool,
+        .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+        .commandBufferCount = COUNT_OF(bundle->commandBuffers),
+    };
+
+    res = VKD.vkAllocateCommandBuffers(grDevice->device, &allocateInfo, bundle->commandBuffers);
+    if (res != VK_SUCCESS) {
+        LOGE("vkAllocateCommandBuffers failed (%d)\n", res);
+        VKD.vkDestroyCommandPool(grDevice->device, bundle->commandPool, NULL);
+        return res;
+    }
+
+    // Create a query pool for timestamps
+    const VkQueryPoolCreateInfo queryPoolCreateInfo = {
+        .sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+        .pNext = NULL,
+        .flags = 0,
+        .queryType = VK_QUERY_TYPE_TIMESTAMP,
+        .queryCount = TIMESTAMP_QUERY_COUNT,
+        .pipelineStatistics = 0,
+    };
+
+    res = VKD.vkCreateQueryPool(grDevice->device, &queryPoolCreateInfo, NULL,
+                                &bundle->timestampQueryPool);
+    if (res != VK_SUCCESS) {
+        LOGE("vkCreateQueryPool failed (%d)\n", res);
+        VKD.vkDestroyCommandPool(grDevice->device, bundle->commandPool, NULL);
+        return res;
+    }
+
+    return VK_SUCCESS;
+}
+
+static void destroyCmdBufferBundle(
+    const GrDevice* grDevice,
+    const CmdBufferBundle* bundle)
+{
+    VKD.vkDestroyCommandPool(grDevice->device, bundle->commandPool, NULL);
+    VKD.vkDestroyQueryPool(grDevice->device, bundle->timestampQueryPool, NULL);
+}
+
+VkResult grDeviceAcquireCmdBufferBundle(
+    CmdBufferBundle* bundle,
+    GrDevice* grDevice,
+    uint32_t queueFamilyIndex)
+{
+    bool isRecycled = false;
+
+    AcquireSRWLockExclusive(&grDevice->cmdBufferBundleLock);
+
+    // Bundles are only released by idle command buffers, any of them can be reset
+    for (unsigned i = 0; i < grDevice->idleCmdBufferBundleCount; i++) {
+        if (grDevice->idleCmdBufferBundles[i].queueFamilyIndex == queueFamilyIndex) {
+            *bundle = grDevice->idleCmdBufferBundles[i];
+            isRecycled = true;
+
+            grDevice->idleCmdBufferBundleCount--;
+            memmove(&grDevice->idleCmdBufferBundles[i], &grDevice->idleCmdBufferBundles[i + 1],
+                    (grDevice->idleCmdBufferBundleCount - i) * sizeof(CmdBufferBundle));
+            break;
+        }
+    }
+
+    ReleaseSRWLockExclusive(&grDevice->cmdBufferBundleLock);
+
+    if (!isRecycled) {
+        return createCmdBufferBundle(bundle, grDevice, queueFamilyIndex);
+    }
+
+    VkResult res = VKD.vkResetCommandPool(grDevice->device, bundle->commandPool, 0);
+    if (res != VK_SUCCESS) {
+        LOGE("vkResetCommandPool failed (%d)\n", res);
+        destroyCmdBufferBundle(grDevice, bundle);
+        return res;
+    }
+
+    return VK_SUCCESS;
+}
+
+void grDeviceReleaseCmdBufferBundle(
+    GrDevice* grDevice,
+    const CmdBufferBundle* bundle)
+{
+    AcquireSRWLockExclusive(&grDevice->cmdBufferBundleLock);
+
+    if (grDevice->idleCmdBufferBundleCount >= MAX_IDLE_BUNDLE_COUNT) {
+        ReleaseSRWLockExclusive(&grDevice->cmdBufferBundleLock);
+        destroyCmdBufferBundle(grDevice, bundle);
+        return;
+    }
+
+    grDevice->idleCmdBufferBundleCount++;
+    grDevice->idleCmdBufferBundles = realloc(grDevice->idleCmdBufferBundles,
+                                             grDevice->idleCmdBufferBundleCount *
+                                             sizeof(CmdBufferBundle));
+    grDevice->idleCmdBufferBundles[grDevice->idleCmdBufferBundleCount - 1] = *bundle;
+
+    ReleaseSRWLockExclusive(&grDevice->cmdBufferBundleLock);
+}
+
+void grDeviceDestroyCmdBufferBundles(
+    GrDevice* grDevice)
+{
+    for (unsigned i = 0; i < grDevice->idleCmdBufferBundleCount; i++) {
+        destroyCmdBufferBundle(grDevice, &grDevice->idleCmdBufferBundles[i]);
+    }
+
+    free(grDevice->idleCmdBufferBundles);
+    grDevice->idleCmdBufferBundleCount = 0;
+    grDevice->idleCmdBufferBundles = NULL;
+}
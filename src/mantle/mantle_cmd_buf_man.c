@@ -5,11 +5,40 @@ void grCmdBufferResetState(
 {
     GrDevice* grDevice = GET_OBJ_DEVICE(grCmdBuffer);
 
-    // Reset descriptor pools
-    unsigned resetCount = MIN(grCmdBuffer->descriptorPoolIndex + 1,
-                              grCmdBuffer->descriptorPoolCount);
-    for (unsigned i = 0; i < resetCount; i++) {
-        VKD.vkResetDescriptorPool(grDevice->device, grCmdBuffer->descriptorPools[i], 0);
+    // The command buffer can't be in flight anymore, recycle its descriptor pools
+    grDeviceReleaseDescriptorPools(grDevice, grCmdBuffer->descriptorPoolCount,
+                                   grCmdBuffer->descriptorPools,
+                                   &grCmdBuffer->descriptorPoolUsage);
+    grCmdBuffer->descriptorPoolCount = 0;
+
+    // Cached descriptor sets were allocated from the pools above
+    for (unsigned i = 0; i < DESCRIPTOR_SET_CACHE_BUCKET_COUNT; i++) {
+        DescriptorSetCacheBucket* bucket = &grCmdBuffer->descriptorSetCache[i];
+
+        for (unsigned j = 0; j < bucket->entryCount; j++) {
+            free(bucket->entries[j].descriptors);
+        }
+        free(bucket->entries);
+
+        bucket->entryCount = 0;
+        bucket->entries = NULL;
+    }
+
+    for (unsigned i = 0; i < DESCRIPTOR_SET_CACHE_BUCKET_COUNT; i++) {
+        DescriptorSetSourceBucket* bucket = &grCmdBuffer->descriptorSetSourceCache[i];
+
+        free(bucket->entries);
+        bucket->entryCount = 0;
+        bucket->entries = NULL;
+    }
+
+    // Resource states are only known within a command buffer
+    for (unsigned i = 0; i < RESOURCE_STATE_BUCKET_COUNT; i++) {
+        ResourceStateBucket* bucket = &grCmdBuffer->resourceStates[i];
+
+        free(bucket->imageEntries);
+        free(bucket->memoryEntries);
+        *bucket = (ResourceStateBucket) { 0 };
     }
 
     // Clear state
@@ -27,10 +56,7 @@ GR_RESULT GR_STDCALL grCreateCommandBuffer(
     LOGT("%p %p %p\n", device, pCreateInfo, pCmdBuffer);
     GrDevice* grDevice = (GrDevice*)device;
     GrQueue* grQueue;
-    VkResult vkRes;
-    VkCommandPool vkCommandPool = VK_NULL_HANDLE;
-    VkCommandBuffer vkCommandBuffer = VK_NULL_HANDLE;
-    VkQueryPool vkQueryPool = VK_NULL_HANDLE;
+    CmdBufferBundle bundle;
 
     if (grDevice == NULL) {
         return GR_ERROR_INVALID_HANDLE;
@@ -47,45 +73,11 @@ GR_RESULT GR_STDCALL grCreateCommandBuffer(
 
     grGetDeviceQueue(device, pCreateInfo->queueType, 0, (GR_QUEUE*)&grQueue);
 
-    const VkCommandPoolCreateInfo poolCreateInfo = {
-        .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
-        .pNext = NULL,
-        .flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT,
-        .queueFamilyIndex = grQueue->queueFamilyIndex,
-    };
-
-    vkRes = VKD.vkCreateCommandPool(grDevice->device, &poolCreateInfo, NULL, &vkCommandPool);
+    VkResult vkRes = grDeviceAcquireCmdBufferBundle(&bundle, grDevice, grQueue->queueFamilyIndex);
     if (vkRes != VK_SUCCESS) {
-        LOGE("vkCreateCommandPool failed (%d)\n", vkRes);
         return getGrResult(vkRes);
     }
 
-    const VkCommandBufferAllocateInfo allocateInfo = {
-        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
-        .pNext = NULL,
-        .commandPool = vkCommandPool,
-        .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
-        .commandBufferCount = 1,
-    };
-
-    vkRes = VKD.vkAllocateCommandBuffers(grDevice->device, &allocateInfo, &vkCommandBuffer);
-    if (vkRes != VK_SUCCESS) {
-        LOGE("vkAllocateCommandBuffers failed (%d)\n", vkRes);
-        return getGrResult(vkRes);
-    }
-
-    // Create a query pool for timestamps
-    const VkQueryPoolCreateInfo queryPoolCreateInfo = {
-        .sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
-        .pNext = NULL,
-        .flags = 0,
-        .queryType = VK_QUERY_TYPE_TIMESTAMP,
-        .queryCount = 1,
-        .pipelineStatistics = 0,
-    };
-
-    VKD.vkCreateQueryPool(grDevice->device, &queryPoolCreateInfo, NULL, &vkQueryPool);
-
     VkBuffer atomicCounterBuffer;
     if (pCreateInfo->queueType == GR_QUEUE_UNIVERSAL) {
         atomicCounterBuffer = grDevice->universalAtomicCounterBuffer;
@@ -95,31 +87,45 @@ GR_RESULT GR_STDCALL grCreateCommandBuffer(
         atomicCounterBuffer = VK_NULL_HANDLE;
     }
 
-    const DescriptorSetSlot atomicCounterSlot = {
-        .type = SLOT_TYPE_BUFFER,
-        .buffer = {
-            .bufferView = VK_NULL_HANDLE,
-            .bufferInfo = {
-                .buffer = atomicCounterBuffer,
-                .offset = 0,
-                .range = VK_WHOLE_SIZE,
-            },
-            .stride = 0, // Ignored
-        },
-    };
+    DescriptorSetSlot atomicCounterSlot;
+    setDescriptorSetSlotBuffer(&atomicCounterSlot, atomicCounterBuffer, 0, VK_WHOLE_SIZE,
+                               VK_NULL_HANDLE, 0);
 
     GrCmdBuffer* grCmdBuffer = malloc(sizeof(GrCmdBuffer));
     *grCmdBuffer = (GrCmdBuffer) {
         .grObj = { GR_OBJ_TYPE_COMMAND_BUFFER, grDevice },
-        .commandPool = vkCommandPool,
-        .commandBuffer = vkCommandBuffer,
-        .timestampQueryPool = vkQueryPool,
+        .queueFamilyIndex = bundle.queueFamilyIndex,
+        .commandPool = bundle.commandPool,
+        .commandBuffer = bundle.commandBuffers[0],
+        .setupCommandBuffer = bundle.commandBuffers[1],
+        .timestampQueryPool = bundle.timestampQueryPool,
+        .timestampResetCount = TIMESTAMP_QUERY_COUNT, // Reset before first use
+        .pendingTimestamps = malloc(TIMESTAMP_QUERY_COUNT * sizeof(PendingTimestamp)),
         .atomicCounterSlot = atomicCounterSlot,
         .descriptorPoolCount = 0,
         .descriptorPools = NULL,
+        .descriptorSetCache = calloc(DESCRIPTOR_SET_CACHE_BUCKET_COUNT,
+                                     sizeof(DescriptorSetCacheBucket)),
+        .descriptorSetSourceCache = calloc(DESCRIPTOR_SET_CACHE_BUCKET_COUNT,
+                                           sizeof(DescriptorSetSourceBucket)),
+        .imageBarriers = NULL,
+        .bufferBarriers = NULL,
+        .resourceStates = calloc(RESOURCE_STATE_BUCKET_COUNT, sizeof(ResourceStateBucket)),
+        .pendingClears = NULL,
+        .multiDraws = grDevice->maxMultiDrawCount > 0 ?
+                      malloc(MULTI_DRAW_BATCH_SIZE * sizeof(MultiDrawInfo)) : NULL,
         .isBuilding = false,
         .isRendering = false,
-        .descriptorPoolIndex = 0,
+        .hasSetupCommands = false,
+        .imageBarrierCount = 0,
+        .bufferBarrierCount = 0,
+        .pendingClearCount = 0,
+        .pendingTimestampCount = 0,
+        .multiDrawCount = 0,
+        .isMultiDrawIndexed = false,
+        .multiDrawFirstInstance = 0,
+        .multiDrawInstanceCount = 0,
+        .descriptorPoolUsage = { 0 },
         .submitFence = NULL,
         .bindPoints = { { 0 }, { 0 } },
         .grViewportState = NULL,
@@ -127,6 +133,9 @@ GR_RESULT GR_STDCALL grCreateCommandBuffer(
         .grMsaaState = NULL,
         .grDepthStencilState = NULL,
         .grColorBlendState = NULL,
+        .dynamicState = { 0 },
+        .grColorTargetViews = { NULL },
+        .grDepthStencilView = NULL,
         .colorAttachmentCount = 0,
         .colorAttachments = { { 0 } },
         .colorFormats = { 0 },
@@ -182,6 +191,13 @@ GR_RESULT GR_STDCALL grBeginCommandBuffer(
     grCmdBufferResetState(grCmdBuffer);
     grCmdBuffer->isBuilding = true;
 
+    if (grCmdBuffer->timestampResetCount > 0) {
+        // The previous recording has completed, recycle its timestamp slots
+        VKD.vkCmdResetQueryPool(grCmdBuffer->commandBuffer, grCmdBuffer->timestampQueryPool,
+                                0, grCmdBuffer->timestampResetCount);
+        grCmdBuffer->timestampResetCount = 0;
+    }
+
     return GR_SUCCESS;
 }
 
@@ -202,6 +218,8 @@ GR_RESULT GR_STDCALL grEndCommandBuffer(
     GrDevice* grDevice = GET_OBJ_DEVICE(grCmdBuffer);
 
     grCmdBufferEndRenderPass(grCmdBuffer);
+    grCmdBufferFlushBarriers(grCmdBuffer);
+    grCmdBufferResolveTimestamps(grCmdBuffer);
 
     VkResult res = VKD.vkEndCommandBuffer(grCmdBuffer->commandBuffer);
     if (res != VK_SUCCESS) {
@@ -209,6 +227,14 @@ GR_RESULT GR_STDCALL grEndCommandBuffer(
         return getGrResult(res);
     }
 
+    if (grCmdBuffer->hasSetupCommands) {
+        res = VKD.vkEndCommandBuffer(grCmdBuffer->setupCommandBuffer);
+        if (res != VK_SUCCESS) {
+            LOGE("vkEndCommandBuffer failed (%d)\n", res);
+            return getGrResult(res);
+        }
+    }
+
     grCmdBuffer->isBuilding = false;
 
     return GR_SUCCESS;
@@ -240,6 +266,14 @@ GR_RESULT GR_STDCALL grResetCommandBuffer(
         return getGrResult(res);
     }
 
+    if (grCmdBuffer->hasSetupCommands) {
+        res = VKD.vkResetCommandBuffer(grCmdBuffer->setupCommandBuffer, 0);
+        if (res != VK_SUCCESS) {
+            LOGE("vkResetCommandBuffer failed (%d)\n", res);
+            return getGrResult(res);
+        }
+    }
+
     grCmdBufferResetState(grCmdBuffer);
 
     return GR_SUCCESS;
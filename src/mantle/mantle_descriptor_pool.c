@@ -0,0 +1,177 @@
+#include <math.h>
+#include "mantle_internal.h"
+
+#define SETS_PER_POOL               (2048)
+#define POOL_SIZE_HEADROOM          (1.25f)
+#define USAGE_SMOOTHING             (0.25f)
+#define MAX_IDLE_RELEASE_COUNT      (512) // Releases before an unused pool gets destroyed
+
+static const VkDescriptorType mDescriptorPoolTypes[DESCRIPTOR_POOL_TYPE_COUNT] = {
+    VK_DESCRIPTOR_TYPE_SAMPLER,
+    VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE,
+    VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,
+    VK_DESCRIPTOR_TYPE_UNIFORM_TEXEL_BUFFER,
+    VK_DESCRIPTOR_TYPE_STORAGE_TEXEL_BUFFER,
+    VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+    VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC,
+};
+
+static VkDescriptorPool createVkDescriptorPool(
+    const GrDevice* grDevice)
+{
+    VkDescriptorPool descriptorPool = VK_NULL_HANDLE;
+    VkDescriptorPoolSize poolSizes[DESCRIPTOR_POOL_TYPE_COUNT];
+
+    // Size pools after the descriptor mix observed so far, but never below what a pool full of
+    // the largest sets seen would need
+    for (unsigned i = 0; i < DESCRIPTOR_POOL_TYPE_COUNT; i++) {
+        float descriptorCount =
+            ceilf(grDevice->descriptorsPerSet[i] * SETS_PER_POOL * POOL_SIZE_HEADROOM);
+
+        poolSizes[i] = (VkDescriptorPoolSize) {
+            .type = mDescriptorPoolTypes[i],
+            .descriptorCount = MAX((uint32_t)descriptorCount,
+                                   grDevice->maxDescriptorsPerSet[i] * SETS_PER_POOL),
+        };
+    }
+
+    const VkDescriptorPoolCreateInfo createInfo = {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
+        .pNext = NULL,
+        .flags = 0,
+        .maxSets = SETS_PER_POOL,
+        .poolSizeCount = COUNT_OF(poolSizes),
+        .pPoolSizes = poolSizes,
+    };
+
+    VkResult res = VKD.vkCreateDescriptorPool(grDevice->device, &createInfo, NULL, &descriptorPool);
+    if (res != VK_SUCCESS) {
+        LOGE("vkCreateDescriptorPool failed (%d)\n", res);
+        assert(false);
+    }
+
+    return descriptorPool;
+}
+
+static void updateDescriptorsPerSet(
+    GrDevice* grDevice,
+    const DescriptorPoolUsage* usage)
+{
+    if (usage->setCount == 0) {
+        return;
+    }
+
+    for (unsigned i = 0; i < DESCRIPTOR_POOL_TYPE_COUNT; i++) {
+        float descriptorsPerSet = (float)usage->descriptorCounts[i] / usage->setCount;
+
+        grDevice->descriptorsPerSet[i] += USAGE_SMOOTHING *
+                                          (descriptorsPerSet - grDevice->descriptorsPerSet[i]);
+        grDevice->maxDescriptorsPerSet[i] = MAX(grDevice->maxDescriptorsPerSet[i],
+                                                usage->maxDescriptorCounts[i]);
+    }
+}
+
+static void trimIdleDescriptorPools(
+    GrDevice* grDevice)
+{
+    unsigned trimCount = 0;
+
+    // Oldest pools come first
+    while (trimCount < grDevice->idleDescriptorPoolCount &&
+           grDevice->descriptorPoolReleaseCount -
+           grDevice->idleDescriptorPools[trimCount].releaseIndex > MAX_IDLE_RELEASE_COUNT) {
+        VKD.vkDestroyDescriptorPool(grDevice->device,
+                                    grDevice->idleDescriptorPools[trimCount].pool, NULL);
+        trimCount++;
+    }
+
+    if (trimCount > 0) {
+        grDevice->idleDescriptorPoolCount -= trimCount;
+        memmove(grDevice->idleDescriptorPools, &grDevice->idleDescriptorPools[trimCount],
+                grDevice->idleDescriptorPoolCount * sizeof(IdleDescriptorPool));
+    }
+}
+
+void getDescriptorPoolUsage(
+    DescriptorPoolUsage* usage,
+    unsigned bindingCount,
+    const VkDescriptorSetLayoutBinding* bindings)
+{
+    memset(usage, 0, sizeof(*usage));
+    usage->setCount = 1;
+
+    for (unsigned i = 0; i < bindingCount; i++) {
+        for (unsigned j = 0; j < DESCRIPTOR_POOL_TYPE_COUNT; j++) {
+            if (bindings[i].descriptorType == mDescriptorPoolTypes[j]) {
+                usage->descriptorCounts[j] += bindings[i].descriptorCount;
+                break;
+            }
+        }
+    }
+
+    memcpy(usage->maxDescriptorCounts, usage->descriptorCounts, sizeof(usage->descriptorCounts));
+}
+
+VkDescriptorPool grDeviceAcquireDescriptorPool(
+    GrDevice* grDevice)
+{
+    VkDescriptorPool descriptorPool = VK_NULL_HANDLE;
+
+    AcquireSRWLockExclusive(&grDevice->descriptorPoolLock);
+
+    if (grDevice->idleDescriptorPoolCount > 0) {
+        // Reuse the most recently released pool
+        grDevice->idleDescriptorPoolCount--;
+        descriptorPool = grDevice->idleDescriptorPools[grDevice->idleDescriptorPoolCount].pool;
+    } else {
+        descriptorPool = createVkDescriptorPool(grDevice);
+    }
+
+    ReleaseSRWLockExclusive(&grDevice->descriptorPoolLock);
+
+    return descriptorPool;
+}
+
+void grDeviceReleaseDescriptorPools(
+    GrDevice* grDevice,
+    unsigned poolCount,
+    const VkDescriptorPool* pools,
+    const DescriptorPoolUsage* usage)
+{
+    AcquireSRWLockExclusive(&grDevice->descriptorPoolLock);
+
+    grDevice->descriptorPoolReleaseCount++;
+    updateDescriptorsPerSet(grDevice, usage);
+
+    if (poolCount > 0) {
+        grDevice->idleDescriptorPools = realloc(grDevice->idleDescriptorPools,
+                                                (grDevice->idleDescriptorPoolCount + poolCount) *
+                                                sizeof(IdleDescriptorPool));
+
+        for (unsigned i = 0; i < poolCount; i++) {
+            VKD.vkResetDescriptorPool(grDevice->device, pools[i], 0);
+
+            grDevice->idleDescriptorPools[grDevice->idleDescriptorPoolCount] = (IdleDescriptorPool) {
+                .pool = pools[i],
+                .releaseIndex = grDevice->descriptorPoolReleaseCount,
+            };
+            grDevice->idleDescriptorPoolCount++;
+        }
+    }
+
+    trimIdleDescriptorPools(grDevice);
+
+    ReleaseSRWLockExclusive(&grDevice->descriptorPoolLock);
+}
+
+void grDeviceDestroyDescriptorPools(
+    GrDevice* grDevice)
+{
+    for (unsigned i = 0; i < grDevice->idleDescriptorPoolCount; i++) {
+        VKD.vkDestroyDescriptorPool(grDevice->device, grDevice->idleDescriptorPools[i].pool, NULL);
+    }
+
+    free(grDevice->idleDescriptorPools);
+    grDevice->idleDescriptorPoolCount = 0;
+    grDevice->idleDescriptorPools = NULL;
+}
@@ -1,14 +1,56 @@
 #include "mantle_internal.h"
 
 inline static void releaseSlot(
-    const GrDevice* grDevice,
+    GrDevice* grDevice,
     DescriptorSetSlot* slot)
 {
-    if (slot->type == SLOT_TYPE_BUFFER) {
-        VKD.vkDestroyBufferView(grDevice->device, slot->buffer.bufferView, NULL);
+    const DescriptorInfo* info = &slot->descriptor.info;
+
+    if (slot->type == SLOT_TYPE_BUFFER && info->bufferView != VK_NULL_HANDLE) {
+        grDeviceReleaseBufferView(grDevice, info->buffer.buffer, info->buffer.offset,
+                                  info->buffer.range, info->bufferView);
     }
 }
 
+inline static void markDescriptorsWritten(
+    GrDevice* grDevice)
+{
+    // Lets command buffers tell whether the sets they resolved earlier are still current.
+    // Called once the slots are written, the full barrier publishes them with the new count.
+    InterlockedIncrement(&grDevice->descriptorWriteCount);
+}
+
+void setDescriptorSetSlotImage(
+    DescriptorSetSlot* slot,
+    VkSampler vkSampler,
+    VkImageView vkImageView,
+    VkImageLayout vkImageLayout)
+{
+    // Padding is cleared so that slots can be copied and compared as raw descriptor data
+    memset(slot, 0, sizeof(*slot));
+    slot->type = SLOT_TYPE_IMAGE;
+    slot->descriptor.info.image.sampler = vkSampler;
+    slot->descriptor.info.image.imageView = vkImageView;
+    slot->descriptor.info.image.imageLayout = vkImageLayout;
+}
+
+void setDescriptorSetSlotBuffer(
+    DescriptorSetSlot* slot,
+    VkBuffer vkBuffer,
+    VkDeviceSize offset,
+    VkDeviceSize range,
+    VkBufferView vkBufferView,
+    VkDeviceSize stride)
+{
+    memset(slot, 0, sizeof(*slot));
+    slot->type = SLOT_TYPE_BUFFER;
+    slot->descriptor.info.buffer.buffer = vkBuffer;
+    slot->descriptor.info.buffer.offset = offset;
+    slot->descriptor.info.buffer.range = range;
+    slot->descriptor.info.bufferView = vkBufferView;
+    slot->descriptor.stride = stride;
+}
+
 // Descriptor Set Functions
 
 GR_RESULT GR_STDCALL grCreateDescriptorSet(
@@ -62,7 +104,7 @@ GR_VOID GR_STDCALL grAttachSamplerDescriptors(
 {
     LOGT("%p %u %u %p\n", descriptorSet, startSlot, slotCount, pSamplers);
     GrDescriptorSet* grDescriptorSet = (GrDescriptorSet*)descriptorSet;
-    const GrDevice* grDevice = GET_OBJ_DEVICE(grDescriptorSet);
+    GrDevice* grDevice = GET_OBJ_DEVICE(grDescriptorSet);
 
     for (unsigned i = 0; i < slotCount; i++) {
         DescriptorSetSlot* slot = &grDescriptorSet->slots[startSlot + i];
@@ -70,17 +112,11 @@ GR_VOID GR_STDCALL grAttachSamplerDescriptors(
 
         releaseSlot(grDevice, slot);
 
-        *slot = (DescriptorSetSlot) {
-            .type = SLOT_TYPE_IMAGE,
-            .image = {
-                .imageInfo = {
-                    .sampler = grSampler->sampler,
-                    .imageView = VK_NULL_HANDLE,
-                    .imageLayout = VK_IMAGE_LAYOUT_UNDEFINED,
-                },
-            },
-        };
+        setDescriptorSetSlotImage(slot, grSampler->sampler, VK_NULL_HANDLE,
+                                  VK_IMAGE_LAYOUT_UNDEFINED);
     }
+
+    markDescriptorsWritten(grDevice);
 }
 
 GR_VOID GR_STDCALL grAttachImageViewDescriptors(
@@ -91,7 +127,7 @@ GR_VOID GR_STDCALL grAttachImageViewDescriptors(
 {
     LOGT("%p %u %u %p\n", descriptorSet, startSlot, slotCount, pImageViews);
     GrDescriptorSet* grDescriptorSet = (GrDescriptorSet*)descriptorSet;
-    const GrDevice* grDevice = GET_OBJ_DEVICE(grDescriptorSet);
+    GrDevice* grDevice = GET_OBJ_DEVICE(grDescriptorSet);
 
     for (unsigned i = 0; i < slotCount; i++) {
         DescriptorSetSlot* slot = &grDescriptorSet->slots[startSlot + i];
@@ -101,17 +137,11 @@ GR_VOID GR_STDCALL grAttachImageViewDescriptors(
 
         releaseSlot(grDevice, slot);
 
-        *slot = (DescriptorSetSlot) {
-            .type = SLOT_TYPE_IMAGE,
-            .image = {
-                .imageInfo = {
-                    .sampler = VK_NULL_HANDLE,
-                    .imageView = grImageView->imageView,
-                    .imageLayout = getVkImageLayout(info->state, isDepthStencil),
-                },
-            },
-        };
+        setDescriptorSetSlotImage(slot, VK_NULL_HANDLE, grImageView->imageView,
+                                  getVkImageLayout(info->state, isDepthStencil));
     }
+
+    markDescriptorsWritten(grDevice);
 }
 
 GR_VOID GR_STDCALL grAttachMemoryViewDescriptors(
@@ -122,8 +152,7 @@ GR_VOID GR_STDCALL grAttachMemoryViewDescriptors(
 {
     LOGT("%p %u %u %p\n", descriptorSet, startSlot, slotCount, pMemViews);
     GrDescriptorSet* grDescriptorSet = (GrDescriptorSet*)descriptorSet;
-    const GrDevice* grDevice = GET_OBJ_DEVICE(grDescriptorSet);
-    VkResult vkRes;
+    GrDevice* grDevice = GET_OBJ_DEVICE(grDescriptorSet);
 
     for (unsigned i = 0; i < slotCount; i++) {
         DescriptorSetSlot* slot = &grDescriptorSet->slots[startSlot + i];
@@ -135,36 +164,16 @@ GR_VOID GR_STDCALL grAttachMemoryViewDescriptors(
         releaseSlot(grDevice, slot);
 
         if (vkFormat != VK_FORMAT_UNDEFINED) {
-            // Create buffer view for typed buffers
-            const VkBufferViewCreateInfo createInfo = {
-                .sType = VK_STRUCTURE_TYPE_BUFFER_VIEW_CREATE_INFO,
-                .pNext = NULL,
-                .flags = 0,
-                .buffer = grGpuMemory->buffer,
-                .format = vkFormat,
-                .offset = info->offset,
-                .range = info->range,
-            };
-
-            vkRes = VKD.vkCreateBufferView(grDevice->device, &createInfo, NULL, &vkBufferView);
-            if (vkRes != VK_SUCCESS) {
-                LOGE("vkCreateBufferView failed (%d)\n", vkRes);
-            }
+            // Typed buffers need a view, shared with other slots covering the same range
+            vkBufferView = grDeviceAcquireBufferView(grDevice, grGpuMemory->buffer, info->offset,
+                                                     info->range, vkFormat);
         }
 
-        *slot = (DescriptorSetSlot) {
-            .type = SLOT_TYPE_BUFFER,
-            .buffer = {
-                .bufferView = vkBufferView,
-                .bufferInfo = {
-                    .buffer = grGpuMemory->buffer,
-                    .offset = info->offset,
-                    .range = info->range,
-                },
-                .stride = info->stride,
-            },
-        };
+        setDescriptorSetSlotBuffer(slot, grGpuMemory->buffer, info->offset, info->range,
+                                   vkBufferView, info->stride);
     }
+
+    markDescriptorsWritten(grDevice);
 }
 
 GR_VOID GR_STDCALL grAttachNestedDescriptors(
@@ -175,7 +184,7 @@ GR_VOID GR_STDCALL grAttachNestedDescriptors(
 {
     LOGT("%p %u %u %p\n", descriptorSet, startSlot, slotCount, pNestedDescriptorSets);
     GrDescriptorSet* grDescriptorSet = (GrDescriptorSet*)descriptorSet;
-    const GrDevice* grDevice = GET_OBJ_DEVICE(grDescriptorSet);
+    GrDevice* grDevice = GET_OBJ_DEVICE(grDescriptorSet);
 
     for (unsigned i = 0; i < slotCount; i++) {
         DescriptorSetSlot* slot = &grDescriptorSet->slots[startSlot + i];
@@ -191,6 +200,8 @@ GR_VOID GR_STDCALL grAttachNestedDescriptors(
             },
         };
     }
+
+    markDescriptorsWritten(grDevice);
 }
 
 GR_VOID GR_STDCALL grClearDescriptorSetSlots(
@@ -200,7 +211,7 @@ GR_VOID GR_STDCALL grClearDescriptorSetSlots(
 {
     LOGT("%p %u %u\n", descriptorSet, startSlot, slotCount);
     GrDescriptorSet* grDescriptorSet = (GrDescriptorSet*)descriptorSet;
-    const GrDevice* grDevice = GET_OBJ_DEVICE(grDescriptorSet);
+    GrDevice* grDevice = GET_OBJ_DEVICE(grDescriptorSet);
 
     for (unsigned i = 0; i < slotCount; i++) {
         DescriptorSetSlot* slot = &grDescriptorSet->slots[startSlot + i];
@@ -209,4 +220,6 @@ GR_VOID GR_STDCALL grClearDescriptorSetSlots(
 
         slot->type = SLOT_TYPE_NONE;
     }
+
+    markDescriptorsWritten(grDevice);
 }
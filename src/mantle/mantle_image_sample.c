@@ -72,6 +72,139 @@ unsigned grImageGetBufferDepthPitch(
            MIP(CEILDIV(extent.height, tileSize), mipLevel);
 }
 
+static VkResult createVkSampler(
+    VkSampler* vkSampler,
+    const GrDevice* grDevice,
+    const SamplerKey* key,
+    bool hasCustomBorderColor)
+{
+    const VkSamplerCustomBorderColorCreateInfoEXT borderColorCreateInfo = {
+        .sType = VK_STRUCTURE_TYPE_SAMPLER_CUSTOM_BORDER_COLOR_CREATE_INFO_EXT,
+        .pNext = NULL,
+        .customBorderColor = key->customBorderColor,
+        .format = VK_FORMAT_UNDEFINED,
+    };
+
+    const VkSamplerCreateInfo createInfo = {
+        .sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO,
+        .pNext = hasCustomBorderColor ? &borderColorCreateInfo : NULL,
+        .flags = 0,
+        .magFilter = key->magFilter,
+        .minFilter = key->minFilter,
+        .mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR,
+        .addressModeU = key->addressModeU,
+        .addressModeV = key->addressModeV,
+        .addressModeW = key->addressModeW,
+        .mipLodBias = key->mipLodBias,
+        .anisotropyEnable = key->anisotropyEnable,
+        .maxAnisotropy = key->maxAnisotropy,
+        .compareEnable = VK_TRUE,
+        .compareOp = key->compareOp,
+        .minLod = key->minLod,
+        .maxLod = key->maxLod,
+        .borderColor = key->borderColor,
+        .unnormalizedCoordinates = VK_FALSE,
+    };
+
+    VkResult res = VKD.vkCreateSampler(grDevice->device, &createInfo, NULL, vkSampler);
+    if (res != VK_SUCCESS) {
+        LOGE("vkCreateSampler failed (%d)\n", res);
+    }
+
+    return res;
+}
+
+static VkResult acquireSamplerCacheEntry(
+    SamplerCacheEntry** samplerEntry,
+    GrDevice* grDevice,
+    const SamplerKey* key,
+    bool hasCustomBorderColor)
+{
+    uint64_t hash = getHash(HASH_INIT, key, sizeof(*key));
+    SamplerCacheEntry** bucket = &grDevice->samplerCache[hash % SAMPLER_CACHE_BUCKET_COUNT];
+    VkResult res = VK_SUCCESS;
+
+    AcquireSRWLockExclusive(&grDevice->samplerLock);
+
+    grDevice->samplerCreateCount++;
+
+    SamplerCacheEntry* entry = *bucket;
+    while (entry != NULL && memcmp(&entry->key, key, sizeof(*key))) {
+        entry = entry->next;
+    }
+
+    if (entry != NULL) {
+        entry->refCount++;
+    } else {
+        VkSampler vkSampler = VK_NULL_HANDLE;
+
+        res = createVkSampler(&vkSampler, grDevice, key, hasCustomBorderColor);
+        if (res == VK_SUCCESS) {
+            entry = malloc(sizeof(SamplerCacheEntry));
+            *entry = (SamplerCacheEntry) {
+                .next = *bucket,
+                .key = *key,
+                .sampler = vkSampler,
+                .refCount = 1,
+            };
+            *bucket = entry;
+
+            grDevice->uniqueSamplerCount++;
+        }
+    }
+
+    ReleaseSRWLockExclusive(&grDevice->samplerLock);
+
+    *samplerEntry = entry;
+    return res;
+}
+
+void grDeviceReleaseSampler(
+    GrDevice* grDevice,
+    SamplerCacheEntry* samplerEntry)
+{
+    uint64_t hash = getHash(HASH_INIT, &samplerEntry->key, sizeof(samplerEntry->key));
+    SamplerCacheEntry** link = &grDevice->samplerCache[hash % SAMPLER_CACHE_BUCKET_COUNT];
+
+    AcquireSRWLockExclusive(&grDevice->samplerLock);
+
+    samplerEntry->refCount--;
+
+    if (samplerEntry->refCount == 0) {
+        while (*link != samplerEntry) {
+            link = &(*link)->next;
+        }
+        *link = samplerEntry->next;
+
+        VKD.vkDestroySampler(grDevice->device, samplerEntry->sampler, NULL);
+        free(samplerEntry);
+    }
+
+    ReleaseSRWLockExclusive(&grDevice->samplerLock);
+}
+
+void grDeviceDestroySamplers(
+    GrDevice* grDevice)
+{
+    LOGI("created %u samplers, %u unique\n",
+         grDevice->samplerCreateCount, grDevice->uniqueSamplerCount);
+
+    for (unsigned i = 0; i < SAMPLER_CACHE_BUCKET_COUNT; i++) {
+        SamplerCacheEntry* entry = grDevice->samplerCache[i];
+
+        while (entry != NULL) {
+            SamplerCacheEntry* next = entry->next;
+
+            VKD.vkDestroySampler(grDevice->device, entry->sampler, NULL);
+            free(entry);
+            entry = next;
+        }
+    }
+
+    free(grDevice->samplerCache);
+    grDevice->samplerCache = NULL;
+}
+
 // Image and Sample Functions
 
 GR_RESULT GR_STDCALL grGetFormatInfo(
@@ -248,6 +381,9 @@ GR_RESULT GR_STDCALL grCreateImage(
             .format = createInfo.format,
             .usage = createInfo.usage,
             .multiplyCubeLayers = false,
+            .imageViewLock = SRWLOCK_INIT,
+            .imageViewCount = 0,
+            .imageViews = NULL,
         };
 
         *pImage = (GR_IMAGE)grImage;
@@ -286,6 +422,9 @@ GR_RESULT GR_STDCALL grCreateImage(
         .format = createInfo.format,
         .usage = createInfo.usage,
         .multiplyCubeLayers = quirkHas(QUIRK_CUBEMAP_LAYER_DIV_6) && isCubic,
+        .imageViewLock = SRWLOCK_INIT,
+        .imageViewCount = 0,
+        .imageViews = NULL,
     };
 
     if (!isTarget) {
@@ -375,7 +514,6 @@ GR_RESULT GR_STDCALL grCreateSampler(
 {
     LOGT("%p %p %p\n", device, pCreateInfo, pSampler);
     GrDevice* grDevice = (GrDevice*)device;
-    VkSampler vkSampler = VK_NULL_HANDLE;
 
     // TODO check invalid values
     if (grDevice == NULL) {
@@ -396,44 +534,33 @@ GR_RESULT GR_STDCALL grCreateSampler(
         memcpy(colorValue.float32, data, 4 * sizeof(float));
     }
 
-    const VkSamplerCustomBorderColorCreateInfoEXT borderColorCreateInfo = {
-        .sType = VK_STRUCTURE_TYPE_SAMPLER_CUSTOM_BORDER_COLOR_CREATE_INFO_EXT,
-        .pNext = NULL,
-        .customBorderColor = colorValue,
-        .format = VK_FORMAT_UNDEFINED,
-    };
-
-    const VkSamplerCreateInfo createInfo = {
-        .sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO,
-        .pNext = customColorIndex >= 0 ? &borderColorCreateInfo : NULL,
-        .flags = 0,
+    const SamplerKey key = {
         .magFilter = getVkFilterMag(pCreateInfo->filter),
         .minFilter = getVkFilterMin(pCreateInfo->filter),
-        .mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR,
         .addressModeU = getVkSamplerAddressMode(pCreateInfo->addressU),
         .addressModeV = getVkSamplerAddressMode(pCreateInfo->addressV),
         .addressModeW = getVkSamplerAddressMode(pCreateInfo->addressW),
         .mipLodBias = pCreateInfo->mipLodBias,
         .anisotropyEnable = pCreateInfo->filter == GR_TEX_FILTER_ANISOTROPIC,
         .maxAnisotropy = pCreateInfo->maxAnisotropy,
-        .compareEnable = VK_TRUE,
         .compareOp = getVkCompareOp(pCreateInfo->compareFunc),
         .minLod = pCreateInfo->minLod,
         .maxLod = pCreateInfo->maxLod,
         .borderColor = vkBorderColor,
-        .unnormalizedCoordinates = VK_FALSE,
+        .customBorderColor = colorValue,
     };
 
-    VkResult res = VKD.vkCreateSampler(grDevice->device, &createInfo, NULL, &vkSampler);
+    SamplerCacheEntry* samplerEntry = NULL;
+    VkResult res = acquireSamplerCacheEntry(&samplerEntry, grDevice, &key, customColorIndex >= 0);
     if (res != VK_SUCCESS) {
-        LOGE("vkCreateSampler failed (%d)\n", res);
         return getGrResult(res);
     }
 
     GrSampler* grSampler = malloc(sizeof(GrSampler));
     *grSampler = (GrSampler) {
         .grObj = { GR_OBJ_TYPE_SAMPLER, grDevice },
-        .sampler = vkSampler,
+        .sampler = samplerEntry->sampler,
+        .samplerEntry = samplerEntry,
     };
 
     *pSampler = (GR_SAMPLER)grSampler;
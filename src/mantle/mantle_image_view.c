@@ -1,5 +1,93 @@
 #include "mantle_internal.h"
 
+static VkResult acquireVkImageView(
+    VkImageView* vkImageView,
+    GrImage* grImage,
+    const VkImageViewCreateInfo* createInfo)
+{
+    const GrDevice* grDevice = GET_OBJ_DEVICE(grImage);
+    VkResult res = VK_SUCCESS;
+
+    const ImageViewKey key = {
+        .viewType = createInfo->viewType,
+        .format = createInfo->format,
+        .components = createInfo->components,
+        .subresourceRange = createInfo->subresourceRange,
+    };
+
+    AcquireSRWLockExclusive(&grImage->imageViewLock);
+
+    for (unsigned i = 0; i < grImage->imageViewCount; i++) {
+        ImageViewCacheEntry* entry = &grImage->imageViews[i];
+
+        if (!memcmp(&entry->key, &key, sizeof(key))) {
+            entry->refCount++;
+            *vkImageView = entry->imageView;
+            ReleaseSRWLockExclusive(&grImage->imageViewLock);
+            return VK_SUCCESS;
+        }
+    }
+
+    res = VKD.vkCreateImageView(grDevice->device, createInfo, NULL, vkImageView);
+    if (res != VK_SUCCESS) {
+        LOGE("vkCreateImageView failed (%d)\n", res);
+        ReleaseSRWLockExclusive(&grImage->imageViewLock);
+        return res;
+    }
+
+    grImage->imageViewCount++;
+    grImage->imageViews = realloc(grImage->imageViews,
+                                  grImage->imageViewCount * sizeof(ImageViewCacheEntry));
+    grImage->imageViews[grImage->imageViewCount - 1] = (ImageViewCacheEntry) {
+        .key = key,
+        .imageView = *vkImageView,
+        .refCount = 1,
+    };
+
+    ReleaseSRWLockExclusive(&grImage->imageViewLock);
+
+    return VK_SUCCESS;
+}
+
+void grImageReleaseView(
+    GrImage* grImage,
+    VkImageView vkImageView)
+{
+    AcquireSRWLockExclusive(&grImage->imageViewLock);
+
+    // Unused views are kept, titles tend to recreate the same views over and over
+    for (unsigned i = 0; i < grImage->imageViewCount; i++) {
+        ImageViewCacheEntry* entry = &grImage->imageViews[i];
+
+        if (entry->imageView == vkImageView) {
+            assert(entry->refCount > 0);
+            entry->refCount--;
+            break;
+        }
+    }
+
+    ReleaseSRWLockExclusive(&grImage->imageViewLock);
+}
+
+void grImageDestroyViews(
+    GrImage* grImage)
+{
+    const GrDevice* grDevice = GET_OBJ_DEVICE(grImage);
+
+    for (unsigned i = 0; i < grImage->imageViewCount; i++) {
+        if (grImage->imageViews[i].refCount > 0) {
+            LOGW("image %p destroyed with %u views still alive\n",
+                 grImage, grImage->imageViews[i].refCount);
+        }
+
+        VKD.vkDestroyImageView(grDevice->device, grImage->imageViews[i].imageView, NULL);
+    }
+
+    free(grImage->imageViews);
+    grImage->imageViewCount = 0;
+    grImage->imageViews = NULL;
+}
+
 // Image View Functions
 
 GR_RESULT GR_STDCALL grCreateImageView(
@@ -94,9 +182,8 @@ GR_RESULT GR_STDCALL grCreateImageView(
         createInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT;
     }
 
-    VkResult res = VKD.vkCreateImageView(grDevice->device, &createInfo, NULL, &vkImageView);
+    VkResult res = acquireVkImageView(&vkImageView, grImage, &createInfo);
     if (res != VK_SUCCESS) {
-        LOGE("vkCreateImageView failed (%d)\n", res);
         return getGrResult(res);
     }
 
@@ -104,6 +191,7 @@ GR_RESULT GR_STDCALL grCreateImageView(
     *grImageView = (GrImageView) {
         .grObj = { GR_OBJ_TYPE_IMAGE_VIEW, grDevice },
         .imageView = vkImageView,
+        .grImage = grImage,
         .format = createInfo.format,
     };
 
@@ -157,9 +245,8 @@ GR_RESULT GR_STDCALL grCreateColorTargetView(
         }
     };
 
-    VkResult res = VKD.vkCreateImageView(grDevice->device, &createInfo, NULL, &vkImageView);
+    VkResult res = acquireVkImageView(&vkImageView, grImage, &createInfo);
     if (res != VK_SUCCESS) {
-        LOGE("vkCreateImageView failed (%d)\n", res);
         return getGrResult(res);
     }
 
@@ -167,6 +254,8 @@ GR_RESULT GR_STDCALL grCreateColorTargetView(
     *grColorTargetView = (GrColorTargetView) {
         .grObj = { GR_OBJ_TYPE_COLOR_TARGET_VIEW, grDevice },
         .imageView = vkImageView,
+        .grImage = grImage,
+        .subresourceRange = createInfo.subresourceRange,
         .extent = {
             MIP(grImage->extent.width, pCreateInfo->mipLevel),
             MIP(grImage->extent.height, pCreateInfo->mipLevel),
@@ -243,9 +332,8 @@ GR_RESULT GR_STDCALL grCreateDepthStencilView(
         }
     };
 
-    VkResult res = VKD.vkCreateImageView(grDevice->device, &createInfo, NULL, &vkImageView);
+    VkResult res = acquireVkImageView(&vkImageView, grImage, &createInfo);
     if (res != VK_SUCCESS) {
-        LOGE("vkCreateImageView failed (%d)\n", res);
         return getGrResult(res);
     }
 
@@ -253,6 +341,8 @@ GR_RESULT GR_STDCALL grCreateDepthStencilView(
     *grDepthStencilView = (GrDepthStencilView) {
         .grObj = { GR_OBJ_TYPE_DEPTH_STENCIL_VIEW, grDevice },
         .imageView = vkImageView,
+        .grImage = grImage,
+        .subresourceRange = createInfo.subresourceRange,
         .extent = {
             MIP(grImage->extent.width, pCreateInfo->mipLevel),
             MIP(grImage->extent.height, pCreateInfo->mipLevel),
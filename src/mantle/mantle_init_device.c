@@ -20,6 +20,20 @@ static char* getGrvkEngineName(
     return grvkEngineName;
 }
 
+static bool isDeviceExtensionSupported(
+    const VkExtensionProperties* extensionProperties,
+    uint32_t extensionPropertyCount,
+    const char* extensionName)
+{
+    for (unsigned i = 0; i < extensionPropertyCount; i++) {
+        if (!strcmp(extensionProperties[i].extensionName, extensionName)) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
 static VkBuffer allocateAtomicCounterBuffer(
     const GrDevice* grDevice,
     unsigned slotCount)
@@ -99,6 +113,7 @@ GR_RESULT GR_STDCALL grInitAndEnumerateGpus(
          pAppInfo->apiVersion);
 
     quirkInit(pAppInfo);
+    stateCacheInit(pAppInfo);
 
     if (pAllocCb != NULL) {
         LOGW("unhandled alloc callbacks\n");
@@ -563,7 +578,7 @@ GR_RESULT GR_STDCALL grCreateDevice(
         },
     };
 
-    const char *deviceExtensions[] = {
+    const char *requiredDeviceExtensions[] = {
         VK_EXT_CUSTOM_BORDER_COLOR_EXTENSION_NAME,
         VK_EXT_EXTENDED_DYNAMIC_STATE_EXTENSION_NAME,
         VK_EXT_SHADER_DEMOTE_TO_HELPER_INVOCATION_EXTENSION_NAME,
@@ -571,6 +586,93 @@ GR_RESULT GR_STDCALL grCreateDevice(
         VK_KHR_SWAPCHAIN_EXTENSION_NAME,
     };
 
+    uint32_t extensionPropertyCount = 0;
+    vki.vkEnumerateDeviceExtensionProperties(grPhysicalGpu->physicalDevice, NULL,
+                                             &extensionPropertyCount, NULL);
+
+    VkExtensionProperties* extensionProperties =
+        malloc(sizeof(VkExtensionProperties) * extensionPropertyCount);
+    vki.vkEnumerateDeviceExtensionProperties(grPhysicalGpu->physicalDevice, NULL,
+                                             &extensionPropertyCount, extensionProperties);
+
+    unsigned deviceExtensionCount = 0;
+    const char *deviceExtensions[COUNT_OF(requiredDeviceExtensions) + 3];
+
+    for (unsigned i = 0; i < COUNT_OF(requiredDeviceExtensions); i++) {
+        deviceExtensions[deviceExtensionCount++] = requiredDeviceExtensions[i];
+    }
+
+    // Optional extensions
+    uint32_t maxPushDescriptors = 0;
+    if (isDeviceExtensionSupported(extensionProperties, extensionPropertyCount,
+                                   VK_KHR_PUSH_DESCRIPTOR_EXTENSION_NAME)) {
+        VkPhysicalDevicePushDescriptorPropertiesKHR pushDescriptorProps = {
+            .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PUSH_DESCRIPTOR_PROPERTIES_KHR,
+            .pNext = NULL,
+        };
+        VkPhysicalDeviceProperties2 props2 = {
+            .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2,
+            .pNext = &pushDescriptorProps,
+        };
+
+        vki.vkGetPhysicalDeviceProperties2(grPhysicalGpu->physicalDevice, &props2);
+        maxPushDescriptors = pushDescriptorProps.maxPushDescriptors;
+        deviceExtensions[deviceExtensionCount++] = VK_KHR_PUSH_DESCRIPTOR_EXTENSION_NAME;
+    }
+
+    VkPhysicalDeviceSynchronization2FeaturesKHR synchronization2 = {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SYNCHRONIZATION_2_FEATURES_KHR,
+        .pNext = NULL,
+        .synchronization2 = VK_FALSE,
+    };
+    if (isDeviceExtensionSupported(extensionProperties, extensionPropertyCount,
+                                   VK_KHR_SYNCHRONIZATION_2_EXTENSION_NAME)) {
+        VkPhysicalDeviceFeatures2 features2 = {
+            .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2,
+            .pNext = &synchronization2,
+        };
+
+        vki.vkGetPhysicalDeviceFeatures2(grPhysicalGpu->physicalDevice, &features2);
+        if (synchronization2.synchronization2) {
+            synchronization2.pNext = deviceFeatures.pNext;
+            deviceFeatures.pNext = &synchronization2;
+            deviceExtensions[deviceExtensionCount++] = VK_KHR_SYNCHRONIZATION_2_EXTENSION_NAME;
+        }
+    }
+
+    VkPhysicalDeviceMultiDrawFeaturesEXT multiDraw = {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MULTI_DRAW_FEATURES_EXT,
+        .pNext = NULL,
+        .multiDraw = VK_FALSE,
+    };
+    uint32_t maxMultiDrawCount = 0;
+    if (isDeviceExtensionSupported(extensionProperties, extensionPropertyCount,
+                                   VK_EXT_MULTI_DRAW_EXTENSION_NAME)) {
+        VkPhysicalDeviceMultiDrawPropertiesEXT multiDrawProps = {
+            .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MULTI_DRAW_PROPERTIES_EXT,
+            .pNext = NULL,
+        };
+        VkPhysicalDeviceProperties2 props2 = {
+            .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2,
+            .pNext = &multiDrawProps,
+        };
+        VkPhysicalDeviceFeatures2 features2 = {
+            .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2,
+            .pNext = &multiDraw,
+        };
+
+        vki.vkGetPhysicalDeviceProperties2(grPhysicalGpu->physicalDevice, &props2);
+        vki.vkGetPhysicalDeviceFeatures2(grPhysicalGpu->physicalDevice, &features2);
+        if (multiDraw.multiDraw) {
+            multiDraw.pNext = deviceFeatures.pNext;
+            deviceFeatures.pNext = &multiDraw;
+            maxMultiDrawCount = multiDrawProps.maxMultiDrawCount;
+            deviceExtensions[deviceExtensionCount++] = VK_EXT_MULTI_DRAW_EXTENSION_NAME;
+        }
+    }
+
+    free(extensionProperties);
+
     const VkDeviceCreateInfo createInfo = {
         .sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO,
         .pNext = &deviceFeatures,
@@ -579,7 +681,7 @@ GR_RESULT GR_STDCALL grCreateDevice(
         .pQueueCreateInfos = queueCreateInfos,
         .enabledLayerCount = 0,
         .ppEnabledLayerNames = NULL,
-        .enabledExtensionCount = COUNT_OF(deviceExtensions),
+        .enabledExtensionCount = deviceExtensionCount,
         .ppEnabledExtensionNames = deviceExtensions,
         .pEnabledFeatures = NULL,
     };
@@ -590,8 +692,8 @@ GR_RESULT GR_STDCALL grCreateDevice(
 
         if (vkRes == VK_ERROR_EXTENSION_NOT_PRESENT) {
             LOGE("missing extension. make sure your Vulkan driver supports:\n");
-            for (unsigned i = 0; i < COUNT_OF(deviceExtensions); i++) {
-                LOGE("- %s\n", deviceExtensions[i]);
+            for (unsigned i = 0; i < COUNT_OF(requiredDeviceExtensions); i++) {
+                LOGE("- %s\n", requiredDeviceExtensions[i]);
             }
         }
 
@@ -604,6 +706,21 @@ GR_RESULT GR_STDCALL grCreateDevice(
     VkPhysicalDeviceMemoryProperties memoryProperties;
     vki.vkGetPhysicalDeviceMemoryProperties(grPhysicalGpu->physicalDevice, &memoryProperties);
 
+    // Shared by all pipelines so that variants can reuse compiled shader stages
+    VkPipelineCache vkPipelineCache = VK_NULL_HANDLE;
+    const VkPipelineCacheCreateInfo pipelineCacheCreateInfo = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO,
+        .pNext = NULL,
+        .flags = 0,
+        .initialDataSize = 0,
+        .pInitialData = NULL,
+    };
+
+    vkRes = vkd.vkCreatePipelineCache(vkDevice, &pipelineCacheCreateInfo, NULL, &vkPipelineCache);
+    if (vkRes != VK_SUCCESS) {
+        LOGW("vkCreatePipelineCache failed (%d)\n", vkRes);
+    }
+
     GrDevice* grDevice = malloc(sizeof(GrDevice));
     *grDevice = (GrDevice) {
         .grBaseObj = { GR_OBJ_TYPE_DEVICE },
@@ -611,14 +728,41 @@ GR_RESULT GR_STDCALL grCreateDevice(
         .device = vkDevice,
         .physicalDevice = grPhysicalGpu->physicalDevice,
         .memoryProperties = memoryProperties,
+        .pipelineCache = vkPipelineCache,
+        .maxPushDescriptors = maxPushDescriptors,
+        .hasSynchronization2 = synchronization2.synchronization2,
+        .maxMultiDrawCount = maxMultiDrawCount,
         .grUniversalQueue = NULL, // Initialized below
         .grComputeQueue = NULL, // Initialized below
         .grDmaQueue = NULL, // Initialized below
         .universalAtomicCounterBuffer = VK_NULL_HANDLE, // Initialized below
         .computeAtomicCounterBuffer = VK_NULL_HANDLE, // Initialized below
         .grBorderColorPalette = NULL,
+        .descriptorWriteCount = 0,
+        .descriptorPoolLock = SRWLOCK_INIT,
+        .idleDescriptorPoolCount = 0,
+        .idleDescriptorPools = NULL,
+        .descriptorPoolReleaseCount = 0,
+        .descriptorsPerSet = { 0 }, // Initialized below
+        .maxDescriptorsPerSet = { 0 }, // Initialized below
+        .bufferViewLock = SRWLOCK_INIT,
+        .bufferViewCache = calloc(BUFFER_VIEW_CACHE_BUCKET_COUNT, sizeof(BufferViewCacheBucket)),
+        .bufferViewReleaseCount = 0,
+        .samplerLock = SRWLOCK_INIT,
+        .samplerCache = calloc(SAMPLER_CACHE_BUCKET_COUNT, sizeof(SamplerCacheEntry*)),
+        .samplerCreateCount = 0,
+        .uniqueSamplerCount = 0,
+        .cmdBufferBundleLock = SRWLOCK_INIT,
+        .idleCmdBufferBundleCount = 0,
+        .idleCmdBufferBundles = NULL,
     };
 
+    // Start with one descriptor of each type per set until actual usage is known
+    for (unsigned i = 0; i < DESCRIPTOR_POOL_TYPE_COUNT; i++) {
+        grDevice->descriptorsPerSet[i] = 1.0f;
+        grDevice->maxDescriptorsPerSet[i] = 1;
+    }
+
     if (universalQueueFamilyIndex != INVALID_QUEUE_INDEX) {
         grDevice->grUniversalQueue =
             grQueueCreate(grDevice, universalQueueFamilyIndex, universalQueueIndex);
@@ -657,6 +801,11 @@ GR_RESULT GR_STDCALL grDestroyDevice(
         return GR_ERROR_INVALID_OBJECT_TYPE;
     }
 
+    grDeviceDestroyDescriptorPools(grDevice);
+    grDeviceDestroyBufferViews(grDevice);
+    grDeviceDestroySamplers(grDevice);
+    grDeviceDestroyCmdBufferBundles(grDevice);
+    VKD.vkDestroyPipelineCache(grDevice->device, grDevice->pipelineCache, NULL);
     VKD.vkDestroyDevice(grDevice->device, NULL);
     free(grDevice);
 
@@ -37,6 +37,9 @@
 #define OFFSET_OF(struct, member) \
     (size_t)(&((struct*)0)->member)
 
+#define HASH_INIT \
+    (0xCBF29CE484222325ull)
+
 #define STACK_ARRAY(type, name, stackCount, count) \
     type _stack_##name[stackCount]; \
     type* name = (count) <= (stackCount) ? _stack_##name : malloc((count) * sizeof(type))
@@ -168,6 +171,89 @@ VkImageSubresourceRange getVkImageSubresourceRange(
     GR_IMAGE_SUBRESOURCE_RANGE subresourceRange,
     bool multiplyCubeLayers);
 
+uint64_t getHash(
+    uint64_t hash,
+    const void* data,
+    size_t size);
+
+void setDescriptorSetSlotImage(
+    DescriptorSetSlot* slot,
+    VkSampler vkSampler,
+    VkImageView vkImageView,
+    VkImageLayout vkImageLayout);
+
+void setDescriptorSetSlotBuffer(
+    DescriptorSetSlot* slot,
+    VkBuffer vkBuffer,
+    VkDeviceSize offset,
+    VkDeviceSize range,
+    VkBufferView vkBufferView,
+    VkDeviceSize stride);
+
+void getDescriptorPoolUsage(
+    DescriptorPoolUsage* usage,
+    unsigned bindingCount,
+    const VkDescriptorSetLayoutBinding* bindings);
+
+VkDescriptorPool grDeviceAcquireDescriptorPool(
+    GrDevice* grDevice);
+
+void grDeviceReleaseDescriptorPools(
+    GrDevice* grDevice,
+    unsigned poolCount,
+    const VkDescriptorPool* pools,
+    const DescriptorPoolUsage* usage);
+
+void grDeviceDestroyDescriptorPools(
+    GrDevice* grDevice);
+
+VkResult grDeviceAcquireCmdBufferBundle(
+    CmdBufferBundle* bundle,
+    GrDevice* grDevice,
+    uint32_t queueFamilyIndex);
+
+void grDeviceReleaseCmdBufferBundle(
+    GrDevice* grDevice,
+    const CmdBufferBundle* bundle);
+
+void grDeviceDestroyCmdBufferBundles(
+    GrDevice* grDevice);
+
+VkBufferView grDeviceAcquireBufferView(
+    GrDevice* grDevice,
+    VkBuffer vkBuffer,
+    VkDeviceSize offset,
+    VkDeviceSize range,
+    VkFormat vkFormat);
+
+void grDeviceReleaseBufferView(
+    GrDevice* grDevice,
+    VkBuffer vkBuffer,
+    VkDeviceSize offset,
+    VkDeviceSize range,
+    VkBufferView vkBufferView);
+
+void grDeviceEvictBufferViews(
+    GrDevice* grDevice,
+    VkBuffer vkBuffer);
+
+void grDeviceDestroyBufferViews(
+    GrDevice* grDevice);
+
+void grDeviceReleaseSampler(
+    GrDevice* grDevice,
+    SamplerCacheEntry* samplerEntry);
+
+void grDeviceDestroySamplers(
+    GrDevice* grDevice);
+
+void grImageReleaseView(
+    GrImage* grImage,
+    VkImageView vkImageView);
+
+void grImageDestroyViews(
+    GrImage* grImage);
+
 void grQueueAddInitialImage(
     GrImage* grImage);
 
@@ -177,4 +263,15 @@ void grQueueRemoveInitialImage(
 void grWsiDestroyImage(
     GrImage* grImage);
 
+void stateCacheInit(
+    const GR_APPLICATION_INFO* appInfo);
+
+unsigned stateCacheGetPipelineVariants(
+    PipelineVariantKey** keys,
+    uint64_t pipelineHash);
+
+void stateCacheAddPipelineVariant(
+    uint64_t pipelineHash,
+    const PipelineVariantKey* key);
+
 #endif // MANTLE_INTERNAL_H_
@@ -202,6 +202,7 @@ GR_RESULT GR_STDCALL grFreeMemory(
 
     GrDevice* grDevice = GET_OBJ_DEVICE(grGpuMemory);
 
+    grDeviceEvictBufferViews(grDevice, grGpuMemory->buffer);
     VKD.vkDestroyBuffer(grDevice->device, grGpuMemory->buffer, NULL);
     VKD.vkFreeMemory(grDevice->device, grGpuMemory->deviceMemory, NULL);
     free(grGpuMemory);
@@ -9,12 +9,22 @@
 #include "amdilc.h"
 
 #define MAX_STAGE_COUNT     5 // VS, HS, DS, GS, PS
+#define ALL_STAGES_MASK     ((1u << MAX_STAGE_COUNT) - 1)
+#define MAX_DESCRIPTOR_SLOT_PATH_DEPTH (8)
+#define DESCRIPTOR_POOL_TYPE_COUNT (7)
 #define MSAA_LEVEL_COUNT    5 // 1, 2, 4, 8, 16x
 
 #define UNIVERSAL_ATOMIC_COUNTERS_COUNT (512)
 #define COMPUTE_ATOMIC_COUNTERS_COUNT   (1024)
 
 #define IMAGE_PREP_CMD_BUFFER_COUNT     (16)
+#define TIMESTAMP_QUERY_COUNT           (64)
+#define MULTI_DRAW_BATCH_SIZE           (64)
+
+#define DESCRIPTOR_SET_CACHE_BUCKET_COUNT   (256)
+#define BUFFER_VIEW_CACHE_BUCKET_COUNT      (256)
+#define SAMPLER_CACHE_BUCKET_COUNT          (64)
+#define RESOURCE_STATE_BUCKET_COUNT         (64)
 
 #define GET_OBJ_TYPE(obj) \
     (((GrBaseObject*)(obj))->grObjType)
@@ -58,29 +68,36 @@ typedef enum _DescriptorSetSlotType
 } DescriptorSetSlotType;
 
 typedef struct _GrColorBlendStateObject GrColorBlendStateObject;
+typedef struct _GrColorTargetView GrColorTargetView;
 typedef struct _GrDepthStencilStateObject GrDepthStencilStateObject;
+typedef struct _GrDepthStencilView GrDepthStencilView;
 typedef struct _GrDescriptorSet GrDescriptorSet;
 typedef struct _GrDevice GrDevice;
 typedef struct _GrFence GrFence;
 typedef struct _GrGpuMemory GrGpuMemory;
+typedef struct _GrImage GrImage;
 typedef struct _GrMsaaStateObject GrMsaaStateObject;
 typedef struct _GrPipeline GrPipeline;
 typedef struct _GrQueue GrQueue;
 typedef struct _GrRasterStateObject GrRasterStateObject;
 typedef struct _GrViewportStateObject GrViewportStateObject;
 
+// Resolved descriptor contents, zeroed before being filled to allow raw comparison
+typedef struct _DescriptorInfo
+{
+    VkDescriptorImageInfo image;
+    VkDescriptorBufferInfo buffer;
+    VkBufferView bufferView;
+} DescriptorInfo;
+
 typedef struct _DescriptorSetSlot
 {
     DescriptorSetSlotType type;
     union {
         struct {
-            VkDescriptorImageInfo imageInfo;
-        } image;
-        struct {
-            VkBufferView bufferView;
-            VkDescriptorBufferInfo bufferInfo;
+            DescriptorInfo info; // Image and buffer slots, in the layout templates read
             VkDeviceSize stride;
-        } buffer;
+        } descriptor;
         struct {
             const GrDescriptorSet* nextSet;
             unsigned slotOffset;
@@ -88,9 +105,181 @@ typedef struct _DescriptorSetSlot
     };
 } DescriptorSetSlot;
 
+typedef struct _DescriptorPoolUsage
+{
+    unsigned setCount;
+    unsigned descriptorCounts[DESCRIPTOR_POOL_TYPE_COUNT];
+    unsigned maxDescriptorCounts[DESCRIPTOR_POOL_TYPE_COUNT]; // Largest single set
+} DescriptorPoolUsage;
+
+typedef struct _IdleDescriptorPool
+{
+    VkDescriptorPool pool;
+    uint64_t releaseIndex;
+} IdleDescriptorPool;
+
+typedef struct _CmdBufferBundle
+{
+    uint32_t queueFamilyIndex;
+    VkCommandPool commandPool;
+    VkCommandBuffer commandBuffers[2]; // Main and setup command buffers
+    VkQueryPool timestampQueryPool;
+} CmdBufferBundle;
+
+// Slot offsets to follow through nested descriptor sets to reach a binding
+typedef struct _DescriptorSlotPath
+{
+    unsigned depth; // 0 if the binding isn't sourced from the descriptor set
+    unsigned slotOffsets[MAX_DESCRIPTOR_SLOT_PATH_DEPTH];
+} DescriptorSlotPath;
+
+typedef struct _DescriptorSetCacheEntry
+{
+    VkDescriptorSetLayout layout;
+    uint64_t hash;
+    unsigned descriptorCount;
+    DescriptorInfo* descriptors;
+    VkDescriptorSet descriptorSet;
+} DescriptorSetCacheEntry;
+
+typedef struct _DescriptorSetCacheBucket
+{
+    unsigned entryCount;
+    DescriptorSetCacheEntry* entries;
+} DescriptorSetCacheBucket;
+
+// Binding state a descriptor set was resolved from
+typedef struct _DescriptorSetSourceKey
+{
+    VkDescriptorSetLayout layout;
+    const GrDescriptorSet* grDescriptorSet;
+    unsigned slotOffset;
+    VkBuffer dynamicBuffer;
+    VkDeviceSize dynamicRange;
+    VkDeviceSize dynamicStride;
+} DescriptorSetSourceKey;
+
+typedef struct _DescriptorSetSourceEntry
+{
+    DescriptorSetSourceKey key;
+    LONG descriptorWriteCount; // Entry is stale once any descriptor set gets written
+    VkDescriptorSet descriptorSet;
+    uint32_t strideMask;
+    uint32_t strides[ILC_MAX_STRIDE_CONSTANTS];
+} DescriptorSetSourceEntry;
+
+typedef struct _DescriptorSetSourceBucket
+{
+    unsigned entryCount;
+    DescriptorSetSourceEntry* entries;
+} DescriptorSetSourceBucket;
+
+typedef struct _BufferViewCacheEntry
+{
+    VkBuffer buffer; // VK_NULL_HANDLE once the buffer is gone
+    VkDeviceSize offset;
+    VkDeviceSize range;
+    VkFormat format;
+    VkBufferView bufferView;
+    unsigned refCount;
+    uint64_t releaseIndex;
+} BufferViewCacheEntry;
+
+typedef struct _BufferViewCacheBucket
+{
+    unsigned entryCount;
+    BufferViewCacheEntry* entries;
+} BufferViewCacheBucket;
+
+// Sampler parameters, all members are 4 bytes wide so that there's no padding
+typedef struct _SamplerKey
+{
+    VkFilter magFilter;
+    VkFilter minFilter;
+    VkSamplerAddressMode addressModeU;
+    VkSamplerAddressMode addressModeV;
+    VkSamplerAddressMode addressModeW;
+    float mipLodBias;
+    VkBool32 anisotropyEnable;
+    float maxAnisotropy;
+    VkCompareOp compareOp;
+    float minLod;
+    float maxLod;
+    VkBorderColor borderColor;
+    VkClearColorValue customBorderColor;
+} SamplerKey;
+
+typedef struct _SamplerCacheEntry
+{
+    struct _SamplerCacheEntry* next;
+    SamplerKey key;
+    VkSampler sampler;
+    unsigned refCount;
+} SamplerCacheEntry;
+
+// Image view parameters, all members are 4 bytes wide so that there's no padding
+typedef struct _ImageViewKey
+{
+    VkImageViewType viewType;
+    VkFormat format;
+    VkComponentMapping components;
+    VkImageSubresourceRange subresourceRange;
+} ImageViewKey;
+
+typedef struct _ImageViewCacheEntry
+{
+    ImageViewKey key;
+    VkImageView imageView;
+    unsigned refCount;
+} ImageViewCacheEntry;
+
+// Last state a command buffer transitioned a resource range to
+typedef struct _ImageStateEntry
+{
+    VkImage image;
+    VkImageSubresourceRange range;
+    GR_IMAGE_STATE state;
+} ImageStateEntry;
+
+typedef struct _MemoryStateEntry
+{
+    VkBuffer buffer;
+    VkDeviceSize offset;
+    VkDeviceSize size;
+    GR_MEMORY_STATE state;
+} MemoryStateEntry;
+
+typedef struct _ResourceStateBucket
+{
+    unsigned imageEntryCount;
+    ImageStateEntry* imageEntries;
+    unsigned memoryEntryCount;
+    MemoryStateEntry* memoryEntries;
+} ResourceStateBucket;
+
+typedef struct _PendingClear
+{
+    VkImage image;
+    VkImageSubresourceRange range;
+    VkClearValue clearValue;
+} PendingClear;
+
+typedef struct _PendingTimestamp
+{
+    VkBuffer buffer;
+    VkDeviceSize offset;
+} PendingTimestamp;
+
+typedef union _MultiDrawInfo
+{
+    VkMultiDrawInfoEXT draw;
+    VkMultiDrawIndexedInfoEXT indexedDraw;
+} MultiDrawInfo;
+
 typedef struct _BindPoint
 {
     uint32_t dirtyFlags;
+    uint32_t dirtyDescriptorSetMask;
     GrPipeline* grPipeline;
     GrDescriptorSet* grDescriptorSet;
     unsigned slotOffset;
@@ -113,16 +302,52 @@ typedef struct _PipelineCreateInfo
     VkColorComponentFlags colorWriteMasks[GR_MAX_COLOR_TARGETS];
 } PipelineCreateInfo;
 
-typedef struct _PipelineSlot
+// State baked into a pipeline variant, compared by value
+typedef struct _PipelineVariantKey
 {
-    VkPipeline pipeline;
-    // TODO keep track of individual parameters to minimize pipeline count
-    const GrColorBlendStateObject* grColorBlendState;
-    const GrMsaaStateObject* grMsaaState;
-    const GrRasterStateObject* grRasterState;
+    VkPipelineColorBlendAttachmentState blendStates[GR_MAX_COLOR_TARGETS];
+    VkSampleCountFlags sampleCountFlags;
+    VkSampleMask sampleMask;
+    VkPolygonMode polygonMode;
     unsigned colorFormatCount;
     VkFormat colorFormats[GR_MAX_COLOR_TARGETS];
     VkFormat depthStencilFormat;
+} PipelineVariantKey;
+
+// State last recorded from the bound state objects, compared by value
+typedef struct _DynamicState
+{
+    uint32_t validMask; // DynamicStateFlags of the state recorded so far
+    unsigned viewportCount;
+    VkViewport viewports[GR_MAX_VIEWPORTS];
+    unsigned scissorCount;
+    VkRect2D scissors[GR_MAX_VIEWPORTS];
+    VkCullModeFlags cullMode;
+    VkFrontFace frontFace;
+    float depthBiasConstantFactor;
+    float depthBiasClamp;
+    float depthBiasSlopeFactor;
+    VkBool32 depthTestEnable;
+    VkBool32 depthWriteEnable;
+    VkCompareOp depthCompareOp;
+    VkBool32 depthBoundsTestEnable;
+    VkBool32 stencilTestEnable;
+    VkStencilOpState front;
+    VkStencilOpState back;
+    float minDepthBounds;
+    float maxDepthBounds;
+    float blendConstants[4];
+    // Baked into pipeline variants
+    VkPolygonMode polygonMode;
+    VkPipelineColorBlendAttachmentState blendStates[GR_MAX_COLOR_TARGETS];
+    VkSampleCountFlags sampleCountFlags;
+    VkSampleMask sampleMask;
+} DynamicState;
+
+typedef struct _PipelineSlot
+{
+    VkPipeline pipeline;
+    PipelineVariantKey key;
 } PipelineSlot;
 
 // Base object
@@ -145,27 +370,57 @@ typedef struct _GrBorderColorPalette {
 
 typedef struct _GrCmdBuffer {
     GrObject grObj;
+    uint32_t queueFamilyIndex;
     VkCommandPool commandPool;
     VkCommandBuffer commandBuffer;
+    VkCommandBuffer setupCommandBuffer; // Submitted ahead of commandBuffer
     VkQueryPool timestampQueryPool;
+    unsigned timestampResetCount; // Slots written since the query pool was last reset
+    PendingTimestamp* pendingTimestamps;
     DescriptorSetSlot atomicCounterSlot;
     // Resource tracking
     unsigned descriptorPoolCount;
     VkDescriptorPool* descriptorPools;
+    DescriptorSetCacheBucket* descriptorSetCache;
+    DescriptorSetSourceBucket* descriptorSetSourceCache;
+    VkImageMemoryBarrier2KHR* imageBarriers;
+    VkBufferMemoryBarrier2KHR* bufferBarriers;
+    ResourceStateBucket* resourceStates;
+    PendingClear* pendingClears;
+    MultiDrawInfo* multiDraws;
     // NOTE: grCmdBufferResetState resets everything past that point
     bool isBuilding;
     bool isRendering;
-    int descriptorPoolIndex;
+    bool hasSetupCommands;
+    // Barriers waiting for the next command that depends on them
+    unsigned imageBarrierCount;
+    unsigned bufferBarrierCount;
+    // Target clears that may still be folded into the next render pass
+    unsigned pendingClearCount;
+    // Timestamps copied to their destination when the command buffer ends
+    unsigned pendingTimestampCount;
+    // Consecutive draws sharing the same state, recorded as a single multi-draw
+    unsigned multiDrawCount;
+    bool isMultiDrawIndexed;
+    uint32_t multiDrawFirstInstance;
+    uint32_t multiDrawInstanceCount;
+    DescriptorPoolUsage descriptorPoolUsage;
     GrFence* submitFence;
     // Graphics and compute bind points
     BindPoint bindPoints[2];
+    // Stride push constants last recorded, shared by both bind points
+    uint32_t strideConstantMask;
+    uint32_t strideConstants[ILC_MAX_STRIDE_CONSTANTS];
     // Graphics dynamic state
     GrViewportStateObject* grViewportState;
     GrRasterStateObject* grRasterState;
     GrMsaaStateObject* grMsaaState;
     GrDepthStencilStateObject* grDepthStencilState;
     GrColorBlendStateObject* grColorBlendState;
+    DynamicState dynamicState;
     // Render pass
+    const GrColorTargetView* grColorTargetViews[GR_MAX_COLOR_TARGETS];
+    const GrDepthStencilView* grDepthStencilView;
     unsigned colorAttachmentCount;
     VkRenderingAttachmentInfoKHR colorAttachments[GR_MAX_COLOR_TARGETS];
     VkFormat colorFormats[GR_MAX_COLOR_TARGETS];
@@ -185,6 +440,8 @@ typedef struct _GrColorBlendStateObject {
 typedef struct _GrColorTargetView {
     GrObject grObj;
     VkImageView imageView;
+    GrImage* grImage;
+    VkImageSubresourceRange subresourceRange;
     VkExtent3D extent;
     VkFormat format;
 } GrColorTargetView;
@@ -205,6 +462,8 @@ typedef struct _GrDepthStencilStateObject {
 typedef struct _GrDepthStencilView {
     GrObject grObj;
     VkImageView imageView;
+    GrImage* grImage;
+    VkImageSubresourceRange subresourceRange;
     VkExtent3D extent;
     VkFormat format;
 } GrDepthStencilView;
@@ -221,12 +480,37 @@ typedef struct _GrDevice {
     VkDevice device;
     VkPhysicalDevice physicalDevice;
     VkPhysicalDeviceMemoryProperties memoryProperties;
+    VkPipelineCache pipelineCache;
+    uint32_t maxPushDescriptors; // 0 if push descriptors are unsupported
+    bool hasSynchronization2;
+    uint32_t maxMultiDrawCount; // 0 if multi-draw is unsupported
     GrQueue* grUniversalQueue;
     GrQueue* grComputeQueue;
     GrQueue* grDmaQueue;
     VkBuffer universalAtomicCounterBuffer;
     VkBuffer computeAtomicCounterBuffer;
     GrBorderColorPalette* grBorderColorPalette;
+    volatile LONG descriptorWriteCount;
+    // Descriptor pools shared by command buffers
+    SRWLOCK descriptorPoolLock;
+    unsigned idleDescriptorPoolCount;
+    IdleDescriptorPool* idleDescriptorPools;
+    uint64_t descriptorPoolReleaseCount;
+    float descriptorsPerSet[DESCRIPTOR_POOL_TYPE_COUNT];
+    unsigned maxDescriptorsPerSet[DESCRIPTOR_POOL_TYPE_COUNT];
+    // Buffer views shared by memory view descriptors
+    SRWLOCK bufferViewLock;
+    BufferViewCacheBucket* bufferViewCache;
+    uint64_t bufferViewReleaseCount;
+    // Samplers shared by identical sampler objects
+    SRWLOCK samplerLock;
+    SamplerCacheEntry** samplerCache;
+    unsigned samplerCreateCount;
+    unsigned uniqueSamplerCount;
+    // Command pools recycled from destroyed command buffers
+    SRWLOCK cmdBufferBundleLock;
+    unsigned idleCmdBufferBundleCount;
+    CmdBufferBundle* idleCmdBufferBundles;
 } GrDevice;
 
 typedef struct _GrEvent {
@@ -257,11 +541,16 @@ typedef struct _GrImage {
     VkFormat format;
     VkImageUsageFlags usage;
     bool multiplyCubeLayers;
+    // Views shared by identical view objects, destroyed along with the image
+    SRWLOCK imageViewLock;
+    unsigned imageViewCount;
+    ImageViewCacheEntry* imageViews;
 } GrImage;
 
 typedef struct _GrImageView {
     GrObject grObj;
     VkImageView imageView;
+    GrImage* grImage;
     VkFormat format;
 } GrImageView;
 
@@ -283,11 +572,21 @@ typedef struct _GrPipeline {
     unsigned pipelineSlotCount;
     PipelineSlot* pipelineSlots;
     SRWLOCK pipelineSlotsLock;
+    volatile LONG refCount; // Held by the application and the prewarm job
+    volatile LONG prewarmCancelled;
+    VkShaderModule rectangleShaderModule;
     VkPipelineLayout pipelineLayout;
     unsigned stageCount;
     VkDescriptorSetLayout descriptorSetLayouts[MAX_STAGE_COUNT];
+    VkDescriptorUpdateTemplate descriptorUpdateTemplates[MAX_STAGE_COUNT];
+    int pushDescriptorSetIndex; // <0 if no set is pushed
     GR_PIPELINE_SHADER shaderInfos[MAX_STAGE_COUNT];
-    unsigned dynamicOffsetCount;
+    DescriptorSlotPath* descriptorSlotPaths[MAX_STAGE_COUNT]; // One per shader binding
+    DescriptorPoolUsage descriptorPoolUsages[MAX_STAGE_COUNT];
+    unsigned dynamicOffsetCounts[MAX_STAGE_COUNT];
+    uint32_t descriptorSetStageMask; // Stages reading from the bound descriptor set
+    uint32_t dynamicMemoryViewStageMask; // Stages reading from the dynamic memory view
+    uint64_t hash;
 } GrPipeline;
 
 typedef struct _GrQueueSemaphore {
@@ -309,6 +608,7 @@ typedef struct _GrRasterStateObject {
 typedef struct _GrSampler {
     GrObject grObj;
     VkSampler sampler;
+    SamplerCacheEntry* samplerEntry;
 } GrSampler;
 
 typedef struct _GrShader {
@@ -355,6 +655,12 @@ typedef struct _GrWsiWinDisplay {
 void grCmdBufferEndRenderPass(
     GrCmdBuffer* grCmdBuffer);
 
+void grCmdBufferFlushBarriers(
+    GrCmdBuffer* grCmdBuffer);
+
+void grCmdBufferResolveTimestamps(
+    GrCmdBuffer* grCmdBuffer);
+
 void grCmdBufferResetState(
     GrCmdBuffer* grCmdBuffer);
 
@@ -384,6 +690,9 @@ VkPipeline grPipelineFindOrCreateVkPipeline(
     const VkFormat* colorFormats,
     VkFormat depthStencilFormat);
 
+void grPipelineRelease(
+    GrPipeline* grPipeline);
+
 GrQueue* grQueueCreate(
     GrDevice* grDevice,
     uint32_t queueFamilyIndex,
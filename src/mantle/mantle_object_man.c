@@ -7,7 +7,7 @@ GR_RESULT GR_STDCALL grDestroyObject(
 {
     LOGT("%p\n", object);
     GrObject* grObject = (GrObject*)object;
-    const GrDevice* grDevice = GET_OBJ_DEVICE(grObject);
+    GrDevice* grDevice = GET_OBJ_DEVICE(grObject);
 
     if (grObject == NULL) {
         return GR_ERROR_INVALID_HANDLE;
@@ -17,12 +17,26 @@ GR_RESULT GR_STDCALL grDestroyObject(
     case GR_OBJ_TYPE_COMMAND_BUFFER: {
         GrCmdBuffer* grCmdBuffer = (GrCmdBuffer*)grObject;
 
-        VKD.vkDestroyCommandPool(grDevice->device, grCmdBuffer->commandPool, NULL);
-        VKD.vkDestroyQueryPool(grDevice->device, grCmdBuffer->timestampQueryPool, NULL);
-        for (unsigned i = 0; i < grCmdBuffer->descriptorPoolCount; i++) {
-            VKD.vkDestroyDescriptorPool(grDevice->device, grCmdBuffer->descriptorPools[i], NULL);
-        }
+        // The command buffer must be idle, hand its descriptor pools and bundle back right away
+        grCmdBufferResetState(grCmdBuffer);
+        free(grCmdBuffer->descriptorSetCache);
+        free(grCmdBuffer->descriptorSetSourceCache);
         free(grCmdBuffer->descriptorPools);
+        free(grCmdBuffer->imageBarriers);
+        free(grCmdBuffer->bufferBarriers);
+        free(grCmdBuffer->resourceStates);
+        free(grCmdBuffer->pendingClears);
+        free(grCmdBuffer->pendingTimestamps);
+        free(grCmdBuffer->multiDraws);
+
+        const CmdBufferBundle bundle = {
+            .queueFamilyIndex = grCmdBuffer->queueFamilyIndex,
+            .commandPool = grCmdBuffer->commandPool,
+            .commandBuffers = { grCmdBuffer->commandBuffer, grCmdBuffer->setupCommandBuffer },
+            .timestampQueryPool = grCmdBuffer->timestampQueryPool,
+        };
+
+        grDeviceReleaseCmdBufferBundle(grDevice, &bundle);
     }   break;
     case GR_OBJ_TYPE_COLOR_BLEND_STATE_OBJECT:
         // Nothing to do
@@ -30,7 +44,7 @@ GR_RESULT GR_STDCALL grDestroyObject(
     case GR_OBJ_TYPE_COLOR_TARGET_VIEW: {
         GrColorTargetView* grColorTargetView = (GrColorTargetView*)grObject;
 
-        VKD.vkDestroyImageView(grDevice->device, grColorTargetView->imageView, NULL);
+        grImageReleaseView(grColorTargetView->grImage, grColorTargetView->imageView);
     }   break;
     case GR_OBJ_TYPE_DEPTH_STENCIL_STATE_OBJECT:
         // Nothing to do
@@ -38,7 +52,7 @@ GR_RESULT GR_STDCALL grDestroyObject(
     case GR_OBJ_TYPE_DEPTH_STENCIL_VIEW: {
         GrDepthStencilView* grDepthStencilView = (GrDepthStencilView*)grObject;
 
-        VKD.vkDestroyImageView(grDevice->device, grDepthStencilView->imageView, NULL);
+        grImageReleaseView(grDepthStencilView->grImage, grDepthStencilView->imageView);
     }   break;
     case GR_OBJ_TYPE_DESCRIPTOR_SET: {
         GrDescriptorSet* grDescriptorSet = (GrDescriptorSet*)grObject;
@@ -59,6 +73,7 @@ GR_RESULT GR_STDCALL grDestroyObject(
     case GR_OBJ_TYPE_IMAGE: {
         GrImage* grImage = (GrImage*)grObject;
 
+        grImageDestroyViews(grImage);
         VKD.vkDestroyImage(grDevice->device, grImage->image, NULL);
         VKD.vkDestroyBuffer(grDevice->device, grImage->buffer, NULL);
 
@@ -68,14 +83,18 @@ GR_RESULT GR_STDCALL grDestroyObject(
     case GR_OBJ_TYPE_IMAGE_VIEW: {
         GrImageView* grImageView = (GrImageView*)grObject;
 
-        VKD.vkDestroyImageView(grDevice->device, grImageView->imageView, NULL);
+        grImageReleaseView(grImageView->grImage, grImageView->imageView);
     }   break;
     case GR_OBJ_TYPE_MSAA_STATE_OBJECT:
         // Nothing to do
         break;
-    case GR_OBJ_TYPE_PIPELINE:
-        // TODO
-        break;
+    case GR_OBJ_TYPE_PIPELINE: {
+        GrPipeline* grPipeline = (GrPipeline*)grObject;
+
+        // Freed once the prewarm job, if any, stops at the next variant
+        InterlockedExchange(&grPipeline->prewarmCancelled, 1);
+        grPipelineRelease(grPipeline);
+    }   return GR_SUCCESS;
     case GR_OBJ_TYPE_QUEUE_SEMAPHORE: {
         GrQueueSemaphore* grQueueSemaphore = (GrQueueSemaphore*)grObject;
 
@@ -87,7 +106,7 @@ GR_RESULT GR_STDCALL grDestroyObject(
     case GR_OBJ_TYPE_SAMPLER: {
         GrSampler* grSampler = (GrSampler*)grObject;
 
-        VKD.vkDestroySampler(grDevice->device, grSampler->sampler, NULL);
+        grDeviceReleaseSampler(grDevice, grSampler->samplerEntry);
     }   break;
     case GR_OBJ_TYPE_SHADER:
         // FIXME actually destroy it?
@@ -281,13 +281,17 @@ GR_RESULT GR_STDCALL grQueueSubmit(
         grFence->submitted = true;
     }
 
-    STACK_ARRAY(VkCommandBuffer, vkCommandBuffers, 1024, cmdBufferCount);
+    STACK_ARRAY(VkCommandBuffer, vkCommandBuffers, 1024, 2 * cmdBufferCount);
+    unsigned vkCommandBufferCount = 0;
 
     for (unsigned i = 0; i < cmdBufferCount; i++) {
         GrCmdBuffer* grCmdBuffer = (GrCmdBuffer*)pCmdBuffers[i];
 
         grCmdBuffer->submitFence = grFence;
-        vkCommandBuffers[i] = grCmdBuffer->commandBuffer;
+        if (grCmdBuffer->hasSetupCommands) {
+            vkCommandBuffers[vkCommandBufferCount++] = grCmdBuffer->setupCommandBuffer;
+        }
+        vkCommandBuffers[vkCommandBufferCount++] = grCmdBuffer->commandBuffer;
     }
 
     const VkSubmitInfo submitInfo = {
@@ -296,7 +300,7 @@ GR_RESULT GR_STDCALL grQueueSubmit(
         .waitSemaphoreCount = 0,
         .pWaitSemaphores = NULL,
         .pWaitDstStageMask = NULL,
-        .commandBufferCount = cmdBufferCount,
+        .commandBufferCount = vkCommandBufferCount,
         .pCommandBuffers = vkCommandBuffers,
         .signalSemaphoreCount = 0,
         .pSignalSemaphores = NULL,
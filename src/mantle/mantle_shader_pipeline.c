@@ -1,11 +1,19 @@
 #include "mantle_internal.h"
 #include "amdilc.h"
 
+#define PUSH_DESCRIPTOR_MAX_BINDING_COUNT   (8)
+
 typedef struct _Stage {
     const GR_PIPELINE_SHADER* shader;
     const VkShaderStageFlagBits flags;
 } Stage;
 
+typedef struct _PrewarmJob {
+    GrPipeline* grPipeline;
+    unsigned keyCount;
+    PipelineVariantKey* keys;
+} PrewarmJob;
+
 static void copyDescriptorSetMapping(
     GR_DESCRIPTOR_SET_MAPPING* dst,
     const GR_DESCRIPTOR_SET_MAPPING* src);
@@ -50,50 +58,260 @@ static void copyPipelineShader(
     dst->dynamicMemoryViewMapping = src->dynamicMemoryViewMapping;
 }
 
-static VkDescriptorSetLayout getVkDescriptorSetLayout(
-    unsigned* dynamicOffsetCount,
+static void freeDescriptorSetMapping(
+    const GR_DESCRIPTOR_SET_MAPPING* mapping)
+{
+    for (unsigned i = 0; i < mapping->descriptorCount; i++) {
+        const GR_DESCRIPTOR_SLOT_INFO* slotInfo = &mapping->pDescriptorInfo[i];
+
+        if (slotInfo->slotObjectType == GR_SLOT_NEXT_DESCRIPTOR_SET) {
+            freeDescriptorSetMapping(slotInfo->pNextLevelSet);
+            free((GR_DESCRIPTOR_SET_MAPPING*)slotInfo->pNextLevelSet);
+        }
+    }
+
+    free((GR_DESCRIPTOR_SLOT_INFO*)mapping->pDescriptorInfo);
+}
+
+static bool findDescriptorSlotPath(
+    DescriptorSlotPath* path,
+    const GR_DESCRIPTOR_SET_MAPPING* mapping,
+    uint32_t bindingIndex)
+{
+    if (path->depth == MAX_DESCRIPTOR_SLOT_PATH_DEPTH) {
+        LOGW("descriptor set nesting is too deep\n");
+        return false;
+    }
+
+    for (unsigned i = 0; i < mapping->descriptorCount; i++) {
+        const GR_DESCRIPTOR_SLOT_INFO* slotInfo = &mapping->pDescriptorInfo[i];
+
+        path->slotOffsets[path->depth] = i;
+
+        if (slotInfo->slotObjectType == GR_SLOT_UNUSED) {
+            continue;
+        } else if (slotInfo->slotObjectType == GR_SLOT_NEXT_DESCRIPTOR_SET) {
+            path->depth++;
+            if (findDescriptorSlotPath(path, slotInfo->pNextLevelSet, bindingIndex)) {
+                return true;
+            }
+            path->depth--;
+            continue;
+        }
+
+        uint32_t slotBinding = slotInfo->shaderEntityIndex;
+        if (slotInfo->slotObjectType == GR_SLOT_SHADER_SAMPLER) {
+            slotBinding += ILC_BASE_SAMPLER_ID;
+        } else {
+            slotBinding += ILC_BASE_RESOURCE_ID;
+        }
+
+        if (slotBinding == bindingIndex) {
+            path->depth++;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static DescriptorSlotPath* getDescriptorSlotPaths(
+    const GR_PIPELINE_SHADER* shaderInfo)
+{
+    const GrShader* grShader = (GrShader*)shaderInfo->shader;
+    const GR_DYNAMIC_MEMORY_VIEW_SLOT_INFO* dynamicSlotInfo = &shaderInfo->dynamicMemoryViewMapping;
+
+    if (grShader == NULL || grShader->bindingCount == 0) {
+        return NULL;
+    }
+
+    // Flatten the mapping hierarchy once so that draws don't have to search it
+    DescriptorSlotPath* paths = calloc(grShader->bindingCount, sizeof(DescriptorSlotPath));
+
+    for (unsigned i = 0; i < grShader->bindingCount; i++) {
+        const IlcBinding* binding = &grShader->bindings[i];
+
+        if (binding->index == ILC_ATOMIC_COUNTER_ID ||
+            (dynamicSlotInfo->slotObjectType != GR_SLOT_UNUSED &&
+             dynamicSlotInfo->shaderEntityIndex + ILC_BASE_RESOURCE_ID == binding->index)) {
+            // Not sourced from the descriptor set
+            continue;
+        }
+
+        // Depth is left at 0 if the binding isn't mapped
+        findDescriptorSlotPath(&paths[i], &shaderInfo->descriptorSetMapping[0], binding->index);
+    }
+
+    return paths;
+}
+
+static size_t getDescriptorInfoOffset(
+    VkDescriptorType vkDescriptorType)
+{
+    switch (vkDescriptorType) {
+    case VK_DESCRIPTOR_TYPE_UNIFORM_TEXEL_BUFFER:
+    case VK_DESCRIPTOR_TYPE_STORAGE_TEXEL_BUFFER:
+        return OFFSET_OF(DescriptorInfo, bufferView);
+    case VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER:
+    case VK_DESCRIPTOR_TYPE_STORAGE_BUFFER:
+    case VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC:
+    case VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC:
+        return OFFSET_OF(DescriptorInfo, buffer);
+    default:
+        break;
+    }
+
+    return OFFSET_OF(DescriptorInfo, image);
+}
+
+static VkDescriptorUpdateTemplate getVkDescriptorUpdateTemplate(
     const GrDevice* grDevice,
+    VkDescriptorSetLayout descriptorSetLayout,
+    unsigned bindingCount,
+    const VkDescriptorSetLayoutBinding* bindings,
+    bool isPushDescriptorSet,
+    VkPipelineBindPoint pipelineBindPoint,
+    VkPipelineLayout pipelineLayout,
+    uint32_t set)
+{
+    VkDescriptorUpdateTemplate updateTemplate = VK_NULL_HANDLE;
+
+    if (bindingCount == 0) {
+        // Nothing to update
+        return VK_NULL_HANDLE;
+    }
+
+    // Descriptors are read from a DescriptorInfo array following the binding order
+    STACK_ARRAY(VkDescriptorUpdateTemplateEntry, entries, 64, bindingCount);
+
+    for (unsigned i = 0; i < bindingCount; i++) {
+        entries[i] = (VkDescriptorUpdateTemplateEntry) {
+            .dstBinding = bindings[i].binding,
+            .dstArrayElement = 0,
+            .descriptorCount = 1,
+            .descriptorType = bindings[i].descriptorType,
+            .offset = i * sizeof(DescriptorInfo) +
+                      getDescriptorInfoOffset(bindings[i].descriptorType),
+            .stride = sizeof(DescriptorInfo),
+        };
+    }
+
+    const VkDescriptorUpdateTemplateCreateInfo createInfo = {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_UPDATE_TEMPLATE_CREATE_INFO,
+        .pNext = NULL,
+        .flags = 0,
+        .descriptorUpdateEntryCount = bindingCount,
+        .pDescriptorUpdateEntries = entries,
+        .templateType = isPushDescriptorSet ?
+                        VK_DESCRIPTOR_UPDATE_TEMPLATE_TYPE_PUSH_DESCRIPTORS_KHR :
+                        VK_DESCRIPTOR_UPDATE_TEMPLATE_TYPE_DESCRIPTOR_SET,
+        .descriptorSetLayout = descriptorSetLayout,
+        .pipelineBindPoint = pipelineBindPoint, // Push descriptors only
+        .pipelineLayout = pipelineLayout, // Push descriptors only
+        .set = set, // Push descriptors only
+    };
+
+    VkResult res = VKD.vkCreateDescriptorUpdateTemplate(grDevice->device, &createInfo, NULL,
+                                                        &updateTemplate);
+    if (res != VK_SUCCESS) {
+        LOGE("vkCreateDescriptorUpdateTemplate failed (%d)\n", res);
+    }
+
+    STACK_ARRAY_FINISH(entries);
+
+    return updateTemplate;
+}
+
+static unsigned getVkDescriptorSetLayoutBindings(
+    VkDescriptorSetLayoutBinding** bindings,
+    unsigned* dynamicOffsetCount,
     const Stage* stage)
 {
-    VkDescriptorSetLayout layout = VK_NULL_HANDLE;
-    unsigned bindingCount = 0;
-    VkDescriptorSetLayoutBinding* bindings = NULL;
+    *bindings = NULL;
 
-    if (stage->shader->shader != GR_NULL_HANDLE) {
-        const GrShader* grShader = stage->shader->shader;
-        const GR_DYNAMIC_MEMORY_VIEW_SLOT_INFO* dynamicSlotInfo =
-            &stage->shader->dynamicMemoryViewMapping;
+    if (stage->shader->shader == GR_NULL_HANDLE) {
+        return 0;
+    }
 
-        bindingCount = grShader->bindingCount;
-        bindings = malloc(bindingCount * sizeof(VkDescriptorSetLayoutBinding));
+    const GrShader* grShader = stage->shader->shader;
+    const GR_DYNAMIC_MEMORY_VIEW_SLOT_INFO* dynamicSlotInfo =
+        &stage->shader->dynamicMemoryViewMapping;
 
-        for (unsigned i = 0; i < grShader->bindingCount; i++) {
-            const IlcBinding* binding = &grShader->bindings[i];
+    *bindings = malloc(grShader->bindingCount * sizeof(VkDescriptorSetLayoutBinding));
 
-            VkDescriptorType vkDescriptorType = binding->descriptorType;
+    for (unsigned i = 0; i < grShader->bindingCount; i++) {
+        const IlcBinding* binding = &grShader->bindings[i];
 
-            if (dynamicSlotInfo->slotObjectType != GR_SLOT_UNUSED &&
-                dynamicSlotInfo->shaderEntityIndex + ILC_BASE_RESOURCE_ID == binding->index) {
-                // Use dynamic offsets for dynamic memory views to avoid invalidating
-                // descriptor sets each time the buffer offset changes
-                vkDescriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC;
-                (*dynamicOffsetCount)++;
-            }
+        VkDescriptorType vkDescriptorType = binding->descriptorType;
+
+        if (dynamicSlotInfo->slotObjectType != GR_SLOT_UNUSED &&
+            dynamicSlotInfo->shaderEntityIndex + ILC_BASE_RESOURCE_ID == binding->index) {
+            // Use dynamic offsets for dynamic memory views to avoid invalidating
+            // descriptor sets each time the buffer offset changes
+            vkDescriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC;
+            (*dynamicOffsetCount)++;
+        }
+
+        (*bindings)[i] = (VkDescriptorSetLayoutBinding) {
+            .binding = binding->index,
+            .descriptorType = vkDescriptorType,
+            .descriptorCount = 1,
+            .stageFlags = stage->flags,
+            .pImmutableSamplers = NULL,
+        };
+    }
+
+    return grShader->bindingCount;
+}
+
+static void getDescriptorSourceStageMasks(
+    uint32_t* descriptorSetStageMask,
+    uint32_t* dynamicMemoryViewStageMask,
+    unsigned stageIndex,
+    unsigned bindingCount,
+    const VkDescriptorSetLayoutBinding* bindings)
+{
+    for (unsigned i = 0; i < bindingCount; i++) {
+        if (bindings[i].descriptorType == VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC) {
+            *dynamicMemoryViewStageMask |= 1u << stageIndex;
+        } else if (bindings[i].binding != ILC_ATOMIC_COUNTER_ID) {
+            *descriptorSetStageMask |= 1u << stageIndex;
+        }
+    }
+}
+
+static bool canUsePushDescriptorSet(
+    const GrDevice* grDevice,
+    unsigned bindingCount,
+    const VkDescriptorSetLayoutBinding* bindings)
+{
+    if (bindingCount == 0 ||
+        bindingCount > MIN(PUSH_DESCRIPTOR_MAX_BINDING_COUNT, grDevice->maxPushDescriptors)) {
+        return false;
+    }
 
-            bindings[i] = (VkDescriptorSetLayoutBinding) {
-                .binding = binding->index,
-                .descriptorType = vkDescriptorType,
-                .descriptorCount = 1,
-                .stageFlags = stage->flags,
-                .pImmutableSamplers = NULL,
-            };
+    // Dynamic descriptors can't be pushed
+    for (unsigned i = 0; i < bindingCount; i++) {
+        if (bindings[i].descriptorType == VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC) {
+            return false;
         }
     }
 
+    return true;
+}
+
+static VkDescriptorSetLayout getVkDescriptorSetLayout(
+    const GrDevice* grDevice,
+    unsigned bindingCount,
+    const VkDescriptorSetLayoutBinding* bindings,
+    bool isPushDescriptorSet)
+{
+    VkDescriptorSetLayout layout = VK_NULL_HANDLE;
+
     const VkDescriptorSetLayoutCreateInfo createInfo = {
         .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
         .pNext = NULL,
-        .flags = 0,
+        .flags = isPushDescriptorSet ? VK_DESCRIPTOR_SET_LAYOUT_CREATE_PUSH_DESCRIPTOR_BIT_KHR : 0,
         .bindingCount = bindingCount,
         .pBindings = bindings,
     };
@@ -103,7 +321,6 @@ static VkDescriptorSetLayout getVkDescriptorSetLayout(
         LOGE("vkCreateDescriptorSetLayout failed (%d)\n", res);
     }
 
-    free(bindings);
     return layout;
 }
 
@@ -139,7 +356,62 @@ static VkPipelineLayout getVkPipelineLayout(
     return layout;
 }
 
-static VkPipeline getVkPipeline(
+static uint64_t getPipelineHash(
+    const Stage* stages,
+    unsigned stageCount,
+    const PipelineCreateInfo* createInfo)
+{
+    uint64_t hash = HASH_INIT;
+
+    // Shader names embed the hash of the IL code, which is stable across runs
+    for (unsigned i = 0; i < stageCount; i++) {
+        const GrShader* grShader = stages[i].shader->shader;
+        const char* name = grShader != NULL ? grShader->name : "";
+
+        hash = getHash(hash, name, strlen(name) + 1);
+    }
+
+    hash = getHash(hash, &createInfo->createFlags, sizeof(createInfo->createFlags));
+    hash = getHash(hash, &createInfo->topology, sizeof(createInfo->topology));
+    hash = getHash(hash, &createInfo->patchControlPoints, sizeof(createInfo->patchControlPoints));
+    hash = getHash(hash, &createInfo->depthClipEnable, sizeof(createInfo->depthClipEnable));
+    hash = getHash(hash, &createInfo->alphaToCoverageEnable,
+                   sizeof(createInfo->alphaToCoverageEnable));
+    hash = getHash(hash, &createInfo->logicOpEnable, sizeof(createInfo->logicOpEnable));
+    hash = getHash(hash, &createInfo->logicOp, sizeof(createInfo->logicOp));
+    hash = getHash(hash, createInfo->colorWriteMasks, sizeof(createInfo->colorWriteMasks));
+
+    return hash;
+}
+
+static bool isPolygonModeIgnored(
+    const PipelineCreateInfo* createInfo)
+{
+    // Polygon mode only applies to triangle rasterization. A geometry shader can emit triangles
+    // from any input, and tessellation uses patch lists, so only the input topology can be trusted
+    // when neither stage is present
+    for (unsigned i = 0; i < createInfo->stageCount; i++) {
+        if (createInfo->stageCreateInfos[i].stage == VK_SHADER_STAGE_GEOMETRY_BIT) {
+            return false;
+        }
+    }
+
+    switch (createInfo->topology) {
+    case VK_PRIMITIVE_TOPOLOGY_POINT_LIST:
+    case VK_PRIMITIVE_TOPOLOGY_LINE_LIST:
+    case VK_PRIMITIVE_TOPOLOGY_LINE_STRIP:
+    case VK_PRIMITIVE_TOPOLOGY_LINE_LIST_WITH_ADJACENCY:
+    case VK_PRIMITIVE_TOPOLOGY_LINE_STRIP_WITH_ADJACENCY:
+        return true;
+    default:
+        break;
+    }
+
+    return false;
+}
+
+static void getPipelineVariantKey(
+    PipelineVariantKey* key,
     const GrPipeline* grPipeline,
     const GrColorBlendStateObject* grColorBlendState,
     const GrMsaaStateObject* grMsaaState,
@@ -147,6 +419,56 @@ static VkPipeline getVkPipeline(
     unsigned colorFormatCount,
     const VkFormat* colorFormats,
     VkFormat depthStencilFormat)
+{
+    // Zero everything so that keys can be compared and stored as raw memory
+    memset(key, 0, sizeof(PipelineVariantKey));
+
+    if (grColorBlendState != NULL) {
+        memcpy(key->blendStates, grColorBlendState->states, sizeof(key->blendStates));
+    }
+    if (grMsaaState != NULL) {
+        key->sampleCountFlags = grMsaaState->sampleCountFlags;
+        key->sampleMask = grMsaaState->sampleMask;
+    }
+    if (grRasterState != NULL) {
+        key->polygonMode = grRasterState->polygonMode;
+    }
+    key->colorFormatCount = colorFormatCount;
+    if (colorFormatCount > 0) {
+        memcpy(key->colorFormats, colorFormats, colorFormatCount * sizeof(VkFormat));
+    }
+    key->depthStencilFormat = depthStencilFormat;
+
+    const PipelineCreateInfo* createInfo = grPipeline->createInfo;
+    if (createInfo == NULL) {
+        // Compute pipeline, nothing to normalize
+        return;
+    }
+
+    // Discard state that doesn't end up in the pipeline so that it doesn't create new variants
+    for (unsigned i = 0; i < GR_MAX_COLOR_TARGETS; i++) {
+        VkColorComponentFlags colorWriteMask = createInfo->colorWriteMasks[i];
+
+        if (colorWriteMask == ~0u || colorWriteMask == 0) {
+            // Unused target or no blending result written
+            memset(&key->blendStates[i], 0, sizeof(key->blendStates[i]));
+        }
+    }
+
+    if (key->sampleCountFlags < VK_SAMPLE_COUNT_32_BIT) {
+        // Only the low bits matching the sample count are considered
+        key->sampleMask &= (1u << key->sampleCountFlags) - 1;
+    }
+
+    if (isPolygonModeIgnored(createInfo)) {
+        key->polygonMode = VK_POLYGON_MODE_FILL;
+    }
+}
+
+static VkPipeline getVkPipeline(
+    const GrPipeline* grPipeline,
+    const PipelineVariantKey* key,
+    VkPipeline basePipeline)
 {
     const GrDevice* grDevice = GET_OBJ_DEVICE(grPipeline);
     const PipelineCreateInfo* createInfo = grPipeline->createInfo;
@@ -202,7 +524,7 @@ static VkPipeline getVkPipeline(
         .flags = 0,
         .depthClampEnable = VK_TRUE,
         .rasterizerDiscardEnable = VK_FALSE,
-        .polygonMode = grRasterState->polygonMode,
+        .polygonMode = key->polygonMode,
         .cullMode = 0, // Dynamic state
         .frontFace = 0, // Dynamic state
         .depthBiasEnable = VK_TRUE,
@@ -216,10 +538,10 @@ static VkPipeline getVkPipeline(
         .sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO,
         .pNext = NULL,
         .flags = 0,
-        .rasterizationSamples = grMsaaState->sampleCountFlags,
+        .rasterizationSamples = key->sampleCountFlags,
         .sampleShadingEnable = VK_FALSE,
         .minSampleShading = 0.f,
-        .pSampleMask = &grMsaaState->sampleMask,
+        .pSampleMask = &key->sampleMask,
         .alphaToCoverageEnable = createInfo->alphaToCoverageEnable,
         .alphaToOneEnable = VK_FALSE,
     };
@@ -243,7 +565,7 @@ static VkPipeline getVkPipeline(
     VkPipelineColorBlendAttachmentState attachments[GR_MAX_COLOR_TARGETS];
 
     for (unsigned i = 0; i < GR_MAX_COLOR_TARGETS; i++) {
-        const VkPipelineColorBlendAttachmentState* blendState = &grColorBlendState->states[i];
+        const VkPipelineColorBlendAttachmentState* blendState = &key->blendStates[i];
         VkColorComponentFlags colorWriteMask = createInfo->colorWriteMasks[i];
 
         if (colorWriteMask == ~0u) {
@@ -305,16 +627,20 @@ static VkPipeline getVkPipeline(
         .sType = VK_STRUCTURE_TYPE_PIPELINE_RENDERING_CREATE_INFO_KHR,
         .pNext = NULL,
         .viewMask = 0,
-        .colorAttachmentCount = colorFormatCount,
-        .pColorAttachmentFormats = colorFormats,
-        .depthAttachmentFormat = depthStencilFormat,
-        .stencilAttachmentFormat = depthStencilFormat,
+        .colorAttachmentCount = key->colorFormatCount,
+        .pColorAttachmentFormats = key->colorFormats,
+        .depthAttachmentFormat = key->depthStencilFormat,
+        .stencilAttachmentFormat = key->depthStencilFormat,
     };
 
+    // Variants only differ by fragment output and rasterization state, derive them from the
+    // first one to let the driver reuse its work
     const VkGraphicsPipelineCreateInfo pipelineCreateInfo = {
         .sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO,
         .pNext = &renderingCreateInfo,
-        .flags = createInfo->createFlags,
+        .flags = createInfo->createFlags |
+                 VK_PIPELINE_CREATE_ALLOW_DERIVATIVES_BIT |
+                 (basePipeline != VK_NULL_HANDLE ? VK_PIPELINE_CREATE_DERIVATIVE_BIT : 0),
         .stageCount = createInfo->stageCount,
         .pStages = createInfo->stageCreateInfos,
         .pVertexInputState = &vertexInputStateCreateInfo,
@@ -329,12 +655,12 @@ static VkPipeline getVkPipeline(
         .layout = grPipeline->pipelineLayout,
         .renderPass = VK_NULL_HANDLE,
         .subpass = 0,
-        .basePipelineHandle = VK_NULL_HANDLE,
-        .basePipelineIndex = 0,
+        .basePipelineHandle = basePipeline,
+        .basePipelineIndex = -1,
     };
 
-    vkRes = VKD.vkCreateGraphicsPipelines(grDevice->device, VK_NULL_HANDLE, 1, &pipelineCreateInfo,
-                                          NULL, &vkPipeline);
+    vkRes = VKD.vkCreateGraphicsPipelines(grDevice->device, grDevice->pipelineCache, 1,
+                                          &pipelineCreateInfo, NULL, &vkPipeline);
     if (vkRes != VK_SUCCESS) {
         LOGE("vkCreateGraphicsPipelines failed (%d)\n", vkRes);
     }
@@ -342,6 +668,114 @@ static VkPipeline getVkPipeline(
     return vkPipeline;
 }
 
+static VkPipeline getBaseVkPipeline(
+    const GrPipeline* grPipeline)
+{
+    return grPipeline->pipelineSlotCount > 0 ? grPipeline->pipelineSlots[0].pipeline
+                                             : VK_NULL_HANDLE;
+}
+
+static VkPipeline findVkPipeline(
+    const GrPipeline* grPipeline,
+    const PipelineVariantKey* key)
+{
+    for (unsigned i = 0; i < grPipeline->pipelineSlotCount; i++) {
+        const PipelineSlot* slot = &grPipeline->pipelineSlots[i];
+
+        if (!memcmp(key, &slot->key, sizeof(PipelineVariantKey))) {
+            return slot->pipeline;
+        }
+    }
+
+    return VK_NULL_HANDLE;
+}
+
+static void addVkPipeline(
+    GrPipeline* grPipeline,
+    VkPipeline vkPipeline,
+    const PipelineVariantKey* key)
+{
+    grPipeline->pipelineSlotCount++;
+    grPipeline->pipelineSlots = realloc(grPipeline->pipelineSlots,
+                                        grPipeline->pipelineSlotCount * sizeof(PipelineSlot));
+    grPipeline->pipelineSlots[grPipeline->pipelineSlotCount - 1] = (PipelineSlot) {
+        .pipeline = vkPipeline,
+        .key = *key,
+    };
+}
+
+static DWORD WINAPI prewarmPipelineVariants(
+    LPVOID param)
+{
+    PrewarmJob* job = param;
+    GrPipeline* grPipeline = job->grPipeline;
+    const GrDevice* grDevice = GET_OBJ_DEVICE(grPipeline);
+
+    unsigned i;
+    for (i = 0; i < job->keyCount && !grPipeline->prewarmCancelled; i++) {
+        const PipelineVariantKey* key = &job->keys[i];
+
+        AcquireSRWLockExclusive(&grPipeline->pipelineSlotsLock);
+        bool isKnown = findVkPipeline(grPipeline, key) != VK_NULL_HANDLE;
+        VkPipeline basePipeline = getBaseVkPipeline(grPipeline);
+        ReleaseSRWLockExclusive(&grPipeline->pipelineSlotsLock);
+
+        if (isKnown) {
+            continue;
+        }
+
+        // Compile outside of the lock so that draws aren't blocked
+        VkPipeline vkPipeline = getVkPipeline(grPipeline, key, basePipeline);
+        if (vkPipeline == VK_NULL_HANDLE) {
+            continue;
+        }
+
+        AcquireSRWLockExclusive(&grPipeline->pipelineSlotsLock);
+        if (findVkPipeline(grPipeline, key) == VK_NULL_HANDLE) {
+            addVkPipeline(grPipeline, vkPipeline, key);
+            vkPipeline = VK_NULL_HANDLE;
+        }
+        ReleaseSRWLockExclusive(&grPipeline->pipelineSlotsLock);
+
+        // A draw needed the same variant first
+        VKD.vkDestroyPipeline(grDevice->device, vkPipeline, NULL);
+    }
+
+    LOGV("prewarmed %u/%u variants for pipeline %016llX\n", i, job->keyCount, grPipeline->hash);
+
+    free(job->keys);
+    free(job);
+    grPipelineRelease(grPipeline);
+    return 0;
+}
+
+static void prewarmPipeline(
+    GrPipeline* grPipeline)
+{
+    PipelineVariantKey* keys = NULL;
+    unsigned keyCount = stateCacheGetPipelineVariants(&keys, grPipeline->hash);
+
+    if (keyCount == 0) {
+        return;
+    }
+
+    PrewarmJob* job = malloc(sizeof(PrewarmJob));
+    *job = (PrewarmJob) {
+        .grPipeline = grPipeline,
+        .keyCount = keyCount,
+        .keys = keys,
+    };
+
+    InterlockedIncrement(&grPipeline->refCount);
+
+    if (!QueueUserWorkItem(prewarmPipelineVariants, job, WT_EXECUTELONGFUNCTION)) {
+        LOGW("failed to queue pipeline prewarm\n");
+        InterlockedDecrement(&grPipeline->refCount);
+        free(job->keys);
+        free(job);
+    }
+}
+
 // Exported Functions
 
 VkPipeline grPipelineFindOrCreateVkPipeline(
@@ -353,44 +787,32 @@ VkPipeline grPipelineFindOrCreateVkPipeline(
     const VkFormat* colorFormats,
     VkFormat depthStencilFormat)
 {
-    VkPipeline vkPipeline = VK_NULL_HANDLE;
+    PipelineVariantKey key;
 
-    AcquireSRWLockExclusive(&grPipeline->pipelineSlotsLock);
+    getPipelineVariantKey(&key, grPipeline, grColorBlendState, grMsaaState, grRasterState,
+                          colorFormatCount, colorFormats, depthStencilFormat);
 
-    for (unsigned i = 0; i < grPipeline->pipelineSlotCount; i++) {
-        const PipelineSlot* slot = &grPipeline->pipelineSlots[i];
+    AcquireSRWLockExclusive(&grPipeline->pipelineSlotsLock);
 
-        if (grColorBlendState == slot->grColorBlendState &&
-            grMsaaState == slot->grMsaaState &&
-            grRasterState == slot->grRasterState &&
-            colorFormatCount == slot->colorFormatCount &&
-            !memcmp(colorFormats, slot->colorFormats, colorFormatCount * sizeof(VkFormat)) &&
-            depthStencilFormat == slot->depthStencilFormat) {
-            vkPipeline = slot->pipeline;
-            break;
-        }
-    }
+    VkPipeline vkPipeline = findVkPipeline(grPipeline, &key);
 
     if (vkPipeline == VK_NULL_HANDLE) {
-        vkPipeline = getVkPipeline(grPipeline, grColorBlendState, grMsaaState, grRasterState,
-                                   colorFormatCount, colorFormats, depthStencilFormat);
-
-        PipelineSlot slot = {
-            .pipeline = vkPipeline,
-            .grColorBlendState = grColorBlendState,
-            .grMsaaState = grMsaaState,
-            .grRasterState = grRasterState,
-            .colorFormatCount = colorFormatCount,
-            .colorFormats = { 0 }, // Initialized below
-            .depthStencilFormat = depthStencilFormat,
-        };
+        LARGE_INTEGER frequency, startCounter, endCounter;
+
+        // Draw-time compiles stall the recording thread, measure how long
+        QueryPerformanceFrequency(&frequency);
+        QueryPerformanceCounter(&startCounter);
 
-        memcpy(slot.colorFormats, colorFormats, colorFormatCount * sizeof(VkFormat));
+        vkPipeline = getVkPipeline(grPipeline, &key, getBaseVkPipeline(grPipeline));
+        addVkPipeline(grPipeline, vkPipeline, &key);
 
-        grPipeline->pipelineSlotCount++;
-        grPipeline->pipelineSlots = realloc(grPipeline->pipelineSlots,
-                                            grPipeline->pipelineSlotCount * sizeof(PipelineSlot));
-        grPipeline->pipelineSlots[grPipeline->pipelineSlotCount - 1] = slot;
+        QueryPerformanceCounter(&endCounter);
+        LOGD("compiled variant %u of pipeline %016llX in %.2f ms\n",
+             grPipeline->pipelineSlotCount, grPipeline->hash,
+             1000.0 * (endCounter.QuadPart - startCounter.QuadPart) / frequency.QuadPart);
+
+        // Remember the variant so it can be compiled ahead of time on the next run
+        stateCacheAddPipelineVariant(grPipeline->hash, &key);
     }
 
     ReleaseSRWLockExclusive(&grPipeline->pipelineSlotsLock);
@@ -398,6 +820,36 @@ VkPipeline grPipelineFindOrCreateVkPipeline(
     return vkPipeline;
 }
 
+void grPipelineRelease(
+    GrPipeline* grPipeline)
+{
+    const GrDevice* grDevice = GET_OBJ_DEVICE(grPipeline);
+
+    if (InterlockedDecrement(&grPipeline->refCount) > 0) {
+        return;
+    }
+
+    for (unsigned i = 0; i < grPipeline->pipelineSlotCount; i++) {
+        VKD.vkDestroyPipeline(grDevice->device, grPipeline->pipelineSlots[i].pipeline, NULL);
+    }
+    for (unsigned i = 0; i < grPipeline->stageCount; i++) {
+        VKD.vkDestroyDescriptorUpdateTemplate(grDevice->device,
+                                              grPipeline->descriptorUpdateTemplates[i], NULL);
+        VKD.vkDestroyDescriptorSetLayout(grDevice->device,
+                                         grPipeline->descriptorSetLayouts[i], NULL);
+        for (unsigned j = 0; j < COUNT_OF(grPipeline->shaderInfos[i].descriptorSetMapping); j++) {
+            freeDescriptorSetMapping(&grPipeline->shaderInfos[i].descriptorSetMapping[j]);
+        }
+        free(grPipeline->descriptorSlotPaths[i]);
+    }
+    VKD.vkDestroyPipelineLayout(grDevice->device, grPipeline->pipelineLayout, NULL);
+    VKD.vkDestroyShaderModule(grDevice->device, grPipeline->rectangleShaderModule, NULL);
+
+    free(grPipeline->pipelineSlots);
+    free(grPipeline->createInfo);
+    free(grPipeline);
+}
+
 // Shader and Pipeline Functions
 
 GR_RESULT GR_STDCALL grCreateShader(
@@ -457,9 +909,16 @@ GR_RESULT GR_STDCALL grCreateGraphicsPipeline(
     GrDevice* grDevice = (GrDevice*)device;
     GR_RESULT res = GR_SUCCESS;
     VkDescriptorSetLayout descriptorSetLayouts[MAX_STAGE_COUNT] = { VK_NULL_HANDLE };
+    VkDescriptorUpdateTemplate descriptorUpdateTemplates[MAX_STAGE_COUNT] = { VK_NULL_HANDLE };
     VkPipelineLayout pipelineLayout = VK_NULL_HANDLE;
     VkShaderModule rectangleShaderModule = VK_NULL_HANDLE;
-    unsigned dynamicOffsetCount = 0;
+    unsigned bindingCounts[MAX_STAGE_COUNT] = { 0 };
+    VkDescriptorSetLayoutBinding* bindings[MAX_STAGE_COUNT] = { NULL };
+    unsigned dynamicOffsetCounts[MAX_STAGE_COUNT] = { 0 };
+    int pushDescriptorSetIndex = -1;
+    uint32_t descriptorSetStageMask = 0;
+    uint32_t dynamicMemoryViewStageMask = 0;
+    DescriptorPoolUsage descriptorPoolUsages[MAX_STAGE_COUNT];
     VkResult vkRes;
 
     // TODO validate parameters
@@ -593,10 +1052,28 @@ GR_RESULT GR_STDCALL grCreateGraphicsPipeline(
     memcpy(pipelineCreateInfo->colorWriteMasks, colorWriteMasks,
            GR_MAX_COLOR_TARGETS * sizeof(VkColorComponentFlags));
 
+    uint64_t hash = getPipelineHash(stages, COUNT_OF(stages), pipelineCreateInfo);
+
+    for (unsigned i = 0; i < COUNT_OF(stages); i++) {
+        bindingCounts[i] = getVkDescriptorSetLayoutBindings(&bindings[i], &dynamicOffsetCounts[i],
+                                                            &stages[i]);
+        getDescriptorSourceStageMasks(&descriptorSetStageMask, &dynamicMemoryViewStageMask, i,
+                                      bindingCounts[i], bindings[i]);
+        getDescriptorPoolUsage(&descriptorPoolUsages[i], bindingCounts[i], bindings[i]);
+    }
+
+    // Only one set per layout can be pushed, pick the largest eligible one
+    for (unsigned i = 0; i < COUNT_OF(stages); i++) {
+        if (canUsePushDescriptorSet(grDevice, bindingCounts[i], bindings[i]) &&
+            (pushDescriptorSetIndex < 0 || bindingCounts[i] > bindingCounts[pushDescriptorSetIndex])) {
+            pushDescriptorSetIndex = i;
+        }
+    }
+
     // Create one descriptor set layout per stage
     for (unsigned i = 0; i < COUNT_OF(stages); i++) {
-        descriptorSetLayouts[i] = getVkDescriptorSetLayout(&dynamicOffsetCount,
-                                                           grDevice, &stages[i]);
+        descriptorSetLayouts[i] = getVkDescriptorSetLayout(grDevice, bindingCounts[i], bindings[i],
+                                                           (int)i == pushDescriptorSetIndex);
         if (descriptorSetLayouts[i] == VK_NULL_HANDLE) {
             res = GR_ERROR_OUT_OF_MEMORY;
             goto bail;
@@ -609,7 +1086,16 @@ GR_RESULT GR_STDCALL grCreateGraphicsPipeline(
         goto bail;
     }
 
-    // TODO keep track of rectangle shader module
+    for (unsigned i = 0; i < COUNT_OF(stages); i++) {
+        descriptorUpdateTemplates[i] =
+            getVkDescriptorUpdateTemplate(grDevice, descriptorSetLayouts[i],
+                                          bindingCounts[i], bindings[i],
+                                          (int)i == pushDescriptorSetIndex,
+                                          VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, i);
+        free(bindings[i]);
+        bindings[i] = NULL;
+    }
+
     GrPipeline* grPipeline = malloc(sizeof(GrPipeline));
     *grPipeline = (GrPipeline) {
         .grObj = { GR_OBJ_TYPE_PIPELINE, grDevice },
@@ -617,24 +1103,43 @@ GR_RESULT GR_STDCALL grCreateGraphicsPipeline(
         .pipelineSlotCount = 0,
         .pipelineSlots = NULL,
         .pipelineSlotsLock = SRWLOCK_INIT,
+        .refCount = 1,
+        .prewarmCancelled = 0,
+        .rectangleShaderModule = rectangleShaderModule,
         .pipelineLayout = pipelineLayout,
         .stageCount = COUNT_OF(stages),
         .descriptorSetLayouts = { 0 }, // Initialized below
+        .descriptorUpdateTemplates = { 0 }, // Initialized below
+        .pushDescriptorSetIndex = pushDescriptorSetIndex,
         .shaderInfos = { { 0 } }, // Initialized below
-        .dynamicOffsetCount = dynamicOffsetCount,
+        .descriptorSlotPaths = { NULL }, // Initialized below
+        .descriptorPoolUsages = { { 0 } }, // Initialized below
+        .dynamicOffsetCounts = { 0 }, // Initialized below
+        .descriptorSetStageMask = descriptorSetStageMask,
+        .dynamicMemoryViewStageMask = dynamicMemoryViewStageMask,
+        .hash = hash,
     };
 
     for (unsigned i = 0; i < COUNT_OF(stages); i++) {
         grPipeline->descriptorSetLayouts[i] = descriptorSetLayouts[i];
+        grPipeline->descriptorUpdateTemplates[i] = descriptorUpdateTemplates[i];
+        grPipeline->descriptorPoolUsages[i] = descriptorPoolUsages[i];
+        grPipeline->dynamicOffsetCounts[i] = dynamicOffsetCounts[i];
         copyPipelineShader(&grPipeline->shaderInfos[i], stages[i].shader);
+        grPipeline->descriptorSlotPaths[i] = getDescriptorSlotPaths(stages[i].shader);
     }
 
+    // Compile variants seen in previous runs before the first draw needs them
+    prewarmPipeline(grPipeline);
+
     *pPipeline = (GR_PIPELINE)grPipeline;
     return GR_SUCCESS;
 
 bail:
     for (unsigned i = 0; i < COUNT_OF(descriptorSetLayouts); i++) {
+        free(bindings[i]);
         VKD.vkDestroyDescriptorSetLayout(grDevice->device, descriptorSetLayouts[i], NULL);
+        VKD.vkDestroyDescriptorUpdateTemplate(grDevice->device, descriptorUpdateTemplates[i], NULL);
     }
     VKD.vkDestroyPipelineLayout(grDevice->device, pipelineLayout, NULL);
     VKD.vkDestroyShaderModule(grDevice->device, rectangleShaderModule, NULL);
@@ -651,9 +1156,14 @@ GR_RESULT GR_STDCALL grCreateComputePipeline(
     GR_RESULT res = GR_SUCCESS;
     VkResult vkRes;
     VkDescriptorSetLayout descriptorSetLayout = VK_NULL_HANDLE;
+    VkDescriptorUpdateTemplate descriptorUpdateTemplate = VK_NULL_HANDLE;
     VkPipelineLayout pipelineLayout = VK_NULL_HANDLE;
     VkPipeline vkPipeline = VK_NULL_HANDLE;
+    VkDescriptorSetLayoutBinding* bindings = NULL;
     unsigned dynamicOffsetCount = 0;
+    uint32_t descriptorSetStageMask = 0;
+    uint32_t dynamicMemoryViewStageMask = 0;
+    DescriptorPoolUsage descriptorPoolUsage;
 
     // TODO validate parameters
 
@@ -676,7 +1186,14 @@ GR_RESULT GR_STDCALL grCreateComputePipeline(
         .pSpecializationInfo = NULL,
     };
 
-    descriptorSetLayout = getVkDescriptorSetLayout(&dynamicOffsetCount, grDevice, &stage);
+    unsigned bindingCount = getVkDescriptorSetLayoutBindings(&bindings, &dynamicOffsetCount, &stage);
+    getDescriptorSourceStageMasks(&descriptorSetStageMask, &dynamicMemoryViewStageMask, 0,
+                                  bindingCount, bindings);
+    getDescriptorPoolUsage(&descriptorPoolUsage, bindingCount, bindings);
+    bool isPushDescriptorSet = canUsePushDescriptorSet(grDevice, bindingCount, bindings);
+
+    descriptorSetLayout = getVkDescriptorSetLayout(grDevice, bindingCount, bindings,
+                                                   isPushDescriptorSet);
     if (descriptorSetLayout == VK_NULL_HANDLE) {
         res = GR_ERROR_OUT_OF_MEMORY;
         goto bail;
@@ -688,6 +1205,13 @@ GR_RESULT GR_STDCALL grCreateComputePipeline(
         goto bail;
     }
 
+    descriptorUpdateTemplate =
+        getVkDescriptorUpdateTemplate(grDevice, descriptorSetLayout, bindingCount, bindings,
+                                      isPushDescriptorSet, VK_PIPELINE_BIND_POINT_COMPUTE,
+                                      pipelineLayout, 0);
+    free(bindings);
+    bindings = NULL;
+
     const VkComputePipelineCreateInfo pipelineCreateInfo = {
         .sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO,
         .pNext = NULL,
@@ -699,8 +1223,8 @@ GR_RESULT GR_STDCALL grCreateComputePipeline(
         .basePipelineIndex = 0,
     };
 
-    vkRes = VKD.vkCreateComputePipelines(grDevice->device, VK_NULL_HANDLE, 1, &pipelineCreateInfo,
-                                         NULL, &vkPipeline);
+    vkRes = VKD.vkCreateComputePipelines(grDevice->device, grDevice->pipelineCache, 1,
+                                         &pipelineCreateInfo, NULL, &vkPipeline);
     if (vkRes != VK_SUCCESS) {
         LOGE("vkCreateComputePipelines failed (%d)\n", vkRes);
         res = getGrResult(vkRes);
@@ -710,7 +1234,7 @@ GR_RESULT GR_STDCALL grCreateComputePipeline(
     PipelineSlot* pipelineSlot = malloc(sizeof(PipelineSlot));
     *pipelineSlot = (PipelineSlot) {
         .pipeline = vkPipeline,
-        .grColorBlendState = NULL,
+        .key = { { { 0 } } }, // Unused
     };
 
     GrPipeline* grPipeline = malloc(sizeof(GrPipeline));
@@ -720,20 +1244,33 @@ GR_RESULT GR_STDCALL grCreateComputePipeline(
         .pipelineSlotCount = 1,
         .pipelineSlots = pipelineSlot,
         .pipelineSlotsLock = SRWLOCK_INIT,
+        .refCount = 1,
+        .prewarmCancelled = 0,
+        .rectangleShaderModule = VK_NULL_HANDLE,
         .pipelineLayout = pipelineLayout,
         .stageCount = 1,
         .descriptorSetLayouts = { descriptorSetLayout },
+        .descriptorUpdateTemplates = { descriptorUpdateTemplate },
+        .pushDescriptorSetIndex = isPushDescriptorSet ? 0 : -1,
         .shaderInfos = { { 0 } }, // Initialized below
-        .dynamicOffsetCount = dynamicOffsetCount,
+        .descriptorSlotPaths = { NULL }, // Initialized below
+        .descriptorPoolUsages = { descriptorPoolUsage },
+        .dynamicOffsetCounts = { dynamicOffsetCount },
+        .descriptorSetStageMask = descriptorSetStageMask,
+        .dynamicMemoryViewStageMask = dynamicMemoryViewStageMask,
+        .hash = 0, // Unused
     };
 
     copyPipelineShader(&grPipeline->shaderInfos[0], stage.shader);
+    grPipeline->descriptorSlotPaths[0] = getDescriptorSlotPaths(stage.shader);
 
     *pPipeline = (GR_PIPELINE)grPipeline;
     return GR_SUCCESS;
 
 bail:
+    free(bindings);
     VKD.vkDestroyDescriptorSetLayout(grDevice->device, descriptorSetLayout, NULL);
+    VKD.vkDestroyDescriptorUpdateTemplate(grDevice->device, descriptorUpdateTemplate, NULL);
     VKD.vkDestroyPipelineLayout(grDevice->device, pipelineLayout, NULL);
     return res;
 }
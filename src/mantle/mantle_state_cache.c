@@ -0,0 +1,213 @@
+#include <ctype.h>
+#include <io.h>
+#include <stdio.h>
+#include "mantle_internal.h"
+
+#define STATE_CACHE_MAGIC        (0x43535247) // "GRSC"
+#define STATE_CACHE_VERSION      (2)
+#define STATE_CACHE_PATH_LEN     (512)
+#define STATE_CACHE_BUCKET_COUNT (256)
+
+typedef struct _StateCacheHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t entrySize;
+} StateCacheHeader;
+
+typedef struct _StateCacheEntry {
+    uint64_t pipelineHash;
+    PipelineVariantKey key;
+} StateCacheEntry;
+
+// Entries of the pipelines whose hash falls into the bucket
+typedef struct _StateCacheBucket {
+    unsigned entryCount;
+    StateCacheEntry* entries;
+} StateCacheBucket;
+
+static SRWLOCK mStateCacheLock = SRWLOCK_INIT;
+static FILE* mStateCacheFile = NULL;
+static unsigned mStateCacheEntryCount = 0;
+static StateCacheBucket mStateCacheBuckets[STATE_CACHE_BUCKET_COUNT];
+
+static bool getStateCachePath(
+    char* path,
+    unsigned pathLen,
+    const GR_APPLICATION_INFO* appInfo)
+{
+    const char* envValue = getenv("GRVK_STATE_CACHE_PATH");
+    const char* appName = appInfo->pAppName != NULL ? appInfo->pAppName : "grvk";
+    char fileName[128];
+
+    if (envValue != NULL && strlen(envValue) == 0) {
+        // Explicitly disabled
+        return false;
+    }
+
+    // Keep the file name portable
+    unsigned nameLen = 0;
+    for (; appName[nameLen] != '\0' && nameLen < sizeof(fileName) - 1; nameLen++) {
+        char c = appName[nameLen];
+        fileName[nameLen] = isalnum((unsigned char)c) || c == '-' || c == '.' ? c : '_';
+    }
+    fileName[nameLen] = '\0';
+
+    if (envValue != NULL) {
+        snprintf(path, pathLen, "%s/%s.grvk_cache", envValue, fileName);
+    } else {
+        snprintf(path, pathLen, "%s.grvk_cache", fileName);
+    }
+
+    return true;
+}
+
+static FILE* createStateCacheFile(
+    const char* path)
+{
+    FILE* file = fopen(path, "w+b");
+
+    if (file == NULL) {
+        LOGW("failed to create state cache %s\n", path);
+        return NULL;
+    }
+
+    const StateCacheHeader header = {
+        .magic = STATE_CACHE_MAGIC,
+        .version = STATE_CACHE_VERSION,
+        .entrySize = sizeof(StateCacheEntry),
+    };
+
+    fwrite(&header, sizeof(header), 1, file);
+    fflush(file);
+    return file;
+}
+
+static bool isStateCacheEntryKnown(
+    uint64_t pipelineHash,
+    const PipelineVariantKey* key)
+{
+    const StateCacheBucket* bucket = &mStateCacheBuckets[pipelineHash % STATE_CACHE_BUCKET_COUNT];
+
+    for (unsigned i = 0; i < bucket->entryCount; i++) {
+        const StateCacheEntry* entry = &bucket->entries[i];
+
+        if (entry->pipelineHash == pipelineHash &&
+            !memcmp(&entry->key, key, sizeof(PipelineVariantKey))) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static void addStateCacheEntry(
+    const StateCacheEntry* entry)
+{
+    StateCacheBucket* bucket = &mStateCacheBuckets[entry->pipelineHash % STATE_CACHE_BUCKET_COUNT];
+
+    bucket->entryCount++;
+    bucket->entries = realloc(bucket->entries, bucket->entryCount * sizeof(StateCacheEntry));
+    bucket->entries[bucket->entryCount - 1] = *entry;
+    mStateCacheEntryCount++;
+}
+
+void stateCacheInit(
+    const GR_APPLICATION_INFO* appInfo)
+{
+    char path[STATE_CACHE_PATH_LEN];
+    StateCacheHeader header;
+
+    AcquireSRWLockExclusive(&mStateCacheLock);
+
+    if (mStateCacheFile != NULL || !getStateCachePath(path, sizeof(path), appInfo)) {
+        ReleaseSRWLockExclusive(&mStateCacheLock);
+        return;
+    }
+
+    FILE* file = fopen(path, "r+b");
+
+    if (file == NULL) {
+        file = createStateCacheFile(path);
+    } else if (fread(&header, sizeof(header), 1, file) != 1 ||
+               header.magic != STATE_CACHE_MAGIC ||
+               header.version != STATE_CACHE_VERSION ||
+               header.entrySize != sizeof(StateCacheEntry)) {
+        LOGW("discarding incompatible state cache %s\n", path);
+        fclose(file);
+        file = createStateCacheFile(path);
+    } else {
+        StateCacheEntry entry;
+        long recordCount = 0;
+
+        for (; fread(&entry, sizeof(entry), 1, file) == 1; recordCount++) {
+            if (isStateCacheEntryKnown(entry.pipelineHash, &entry.key)) {
+                continue;
+            }
+
+            addStateCacheEntry(&entry);
+        }
+
+        // Append after the last complete record, dropping a truncated trailing one if any
+        long recordEnd = sizeof(header) + recordCount * sizeof(StateCacheEntry);
+        fseek(file, recordEnd, SEEK_SET);
+        _chsize(_fileno(file), recordEnd);
+
+        LOGI("loaded %u pipeline variants from state cache %s\n", mStateCacheEntryCount, path);
+    }
+
+    mStateCacheFile = file;
+
+    ReleaseSRWLockExclusive(&mStateCacheLock);
+}
+
+unsigned stateCacheGetPipelineVariants(
+    PipelineVariantKey** keys,
+    uint64_t pipelineHash)
+{
+    unsigned keyCount = 0;
+
+    *keys = NULL;
+
+    AcquireSRWLockExclusive(&mStateCacheLock);
+
+    const StateCacheBucket* bucket = &mStateCacheBuckets[pipelineHash % STATE_CACHE_BUCKET_COUNT];
+
+    for (unsigned i = 0; i < bucket->entryCount; i++) {
+        const StateCacheEntry* entry = &bucket->entries[i];
+
+        if (entry->pipelineHash == pipelineHash) {
+            keyCount++;
+            *keys = realloc(*keys, keyCount * sizeof(PipelineVariantKey));
+            (*keys)[keyCount - 1] = entry->key;
+        }
+    }
+
+    ReleaseSRWLockExclusive(&mStateCacheLock);
+
+    return keyCount;
+}
+
+void stateCacheAddPipelineVariant(
+    uint64_t pipelineHash,
+    const PipelineVariantKey* key)
+{
+    AcquireSRWLockExclusive(&mStateCacheLock);
+
+    if (mStateCacheFile == NULL || isStateCacheEntryKnown(pipelineHash, key)) {
+        ReleaseSRWLockExclusive(&mStateCacheLock);
+        return;
+    }
+
+    StateCacheEntry entry;
+    memset(&entry, 0, sizeof(entry));
+    entry.pipelineHash = pipelineHash;
+    entry.key = *key;
+
+    addStateCacheEntry(&entry);
+
+    // Flush right away, games are rarely shut down cleanly
+    fwrite(&entry, sizeof(entry), 1, mStateCacheFile);
+    fflush(mStateCacheFile);
+
+    ReleaseSRWLockExclusive(&mStateCacheLock);
+}
@@ -160,7 +160,9 @@ static void recordCopyCommandBuffer(
     };
 
     VKD.vkCmdBlitImage(commandBuffer,
-                       srcImage, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                       srcImage,
+                       getVkImageLayout((GR_IMAGE_STATE)GR_WSI_WIN_IMAGE_STATE_PRESENT_WINDOWED,
+                                        false),
                        dstImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
                        1, &region, VK_FILTER_NEAREST);
 
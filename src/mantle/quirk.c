@@ -18,6 +18,11 @@ void quirkInit(
         mQuirks = QUIRK_NON_ZERO_MEM_REQ;
     }
 
+    const char* generalLayouts = getenv("GRVK_GENERAL_IMAGE_LAYOUTS");
+    if (generalLayouts != NULL && !strcmp(generalLayouts, "1")) {
+        mQuirks |= QUIRK_GENERAL_IMAGE_LAYOUTS;
+    }
+
     if (mQuirks != 0) {
         LOGI("enabled 0x%X\n", mQuirks);
     }
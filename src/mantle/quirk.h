@@ -21,6 +21,9 @@ typedef enum {
 
     // Cubemap layer index and count are divided by 6
     QUIRK_CUBEMAP_LAYER_DIV_6 = 1 << 5,
+
+    // Keep non-transfer images in the general layout to avoid layout transitions (opt-in)
+    QUIRK_GENERAL_IMAGE_LAYOUTS = 1 << 6,
 } QUIRK_FLAGS;
 
 void quirkInit(
@@ -366,6 +366,20 @@ VkImageLayout getVkImageLayout(
     GR_IMAGE_STATE imageState,
     bool isDepthStencil)
 {
+    if (quirkHas(QUIRK_GENERAL_IMAGE_LAYOUTS)) {
+        // Only clears, presents and discards keep a dedicated layout
+        switch ((unsigned)imageState) {
+        case GR_IMAGE_STATE_UNINITIALIZED:
+        case GR_IMAGE_STATE_DISCARD:
+        case GR_IMAGE_STATE_CLEAR:
+        case GR_WSI_WIN_IMAGE_STATE_PRESENT_WINDOWED:
+        case GR_WSI_WIN_IMAGE_STATE_PRESENT_FULLSCREEN:
+            break;
+        default:
+            return VK_IMAGE_LAYOUT_GENERAL;
+        }
+    }
+
     switch (imageState) {
     case GR_IMAGE_STATE_DATA_TRANSFER:
         return VK_IMAGE_LAYOUT_GENERAL; // Direction is unknown
@@ -1164,3 +1178,19 @@ VkImageSubresourceRange getVkImageSubresourceRange(
                       VK_REMAINING_ARRAY_LAYERS : subresourceRange.arraySize * layerFactor,
     };
 }
+
+uint64_t getHash(
+    uint64_t hash,
+    const void* data,
+    size_t size)
+{
+    // 64-bit FNV-1a
+    const uint8_t* bytes = data;
+
+    for (size_t i = 0; i < size; i++) {
+        hash ^= bytes[i];
+        hash *= 0x100000001B3ull;
+    }
+
+    return hash;
+}
@@ -205,6 +205,20 @@ void vulkanLoaderDeviceInit(
     LOAD_VULKAN_DEV_FN(vkd, device, vkCmdEndRenderingKHR);
 #endif
 
+#ifdef VK_KHR_push_descriptor
+    LOAD_VULKAN_DEV_FN(vkd, device, vkCmdPushDescriptorSetKHR);
+    LOAD_VULKAN_DEV_FN(vkd, device, vkCmdPushDescriptorSetWithTemplateKHR);
+#endif
+
+#ifdef VK_KHR_synchronization2
+    LOAD_VULKAN_DEV_FN(vkd, device, vkCmdPipelineBarrier2KHR);
+#endif
+
+#ifdef VK_EXT_multi_draw
+    LOAD_VULKAN_DEV_FN(vkd, device, vkCmdDrawMultiEXT);
+    LOAD_VULKAN_DEV_FN(vkd, device, vkCmdDrawMultiIndexedEXT);
+#endif
+
 #ifdef VK_KHR_swapchain
     LOAD_VULKAN_DEV_FN(vkd, device, vkCreateSwapchainKHR);
     LOAD_VULKAN_DEV_FN(vkd, device, vkDestroySwapchainKHR);
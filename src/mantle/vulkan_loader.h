@@ -187,6 +187,20 @@ typedef struct _VULKAN_DEVICE {
     VULKAN_FN(vkCmdEndRenderingKHR);
 #endif
 
+#ifdef VK_KHR_push_descriptor
+    VULKAN_FN(vkCmdPushDescriptorSetKHR);
+    VULKAN_FN(vkCmdPushDescriptorSetWithTemplateKHR);
+#endif
+
+#ifdef VK_KHR_synchronization2
+    VULKAN_FN(vkCmdPipelineBarrier2KHR);
+#endif
+
+#ifdef VK_EXT_multi_draw
+    VULKAN_FN(vkCmdDrawMultiEXT);
+    VULKAN_FN(vkCmdDrawMultiIndexedEXT);
+#endif
+
 #ifdef VK_KHR_swapchain
     VULKAN_FN(vkCreateSwapchainKHR);
     VULKAN_FN(vkDestroySwapchainKHR);